@@ -0,0 +1,946 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Benchmarks for the various bits of dupscan. Not built by default -
+ * use "make bench". Each benchmark is a sub-command:
+ *
+ *	bench hash <file>...	files/sec, in-process vs popen(sha256sum)
+ *	bench reader <file>...	MiB/s and page cache left behind, for each reader
+ *	bench kernels [MiB]	GB/s for each SHA-256 kernel this CPU runs
+ *	bench algos [MiB]	GB/s for each hash algorithm (-a)
+ *	bench multi [n [KiB]]	n same-size messages, one at a time vs multi-buffer
+ *	bench index [max]	size index insert/lookup, 10k entries up to max
+ *	bench walk <dir> [max]	parallel scan rate, 1 thread up to max (64)
+ *	bench paths [n]		memory for n paths, full strings vs dir nodes
+ *	bench group [n]		grouping n files by size, linked lists vs columns
+ *	bench order <dir> [ms]	seeks and time, discovery vs physical order (-P)
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sha256.h"
+#include "hash.h"
+#include "sizeidx.h"
+#include "paths.h"
+#include "walk.h"
+#include "columns.h"
+#include "inoset.h"
+#include "extent.h"
+
+#ifdef __FreeBSD__
+#  define HASH_COMMAND	"sha256 -q"
+#else
+#  define HASH_COMMAND	"sha256sum"
+#endif
+
+int		bench_hash(int, char *[]);
+int		bench_reader(int, char *[]);
+size_t		cached_bytes(const char *, int, size_t *);
+int		bench_kernels(int, char *[]);
+int		bench_algos(int, char *[]);
+int		bench_multi(int, char *[]);
+int		bench_index(int, char *[]);
+int		bench_walk(int, char *[]);
+void		walk_count(int, struct dirnode *, const char *, struct stat *);
+int		bench_paths(int, char *[]);
+int		bench_group(int, char *[]);
+int		bench_order(int, char *[]);
+void		order_add(int, struct dirnode *, const char *, struct stat *);
+int		order_cmp(const void *, const void *);
+size_t		heap_used();
+double		now();
+void		usage();
+
+struct	bench	{
+	char	*name;
+	int	(*func)(int, char *[]);
+} benchmarks[] = {
+	{"hash",	bench_hash},
+	{"reader",	bench_reader},
+	{"kernels",	bench_kernels},
+	{"algos",	bench_algos},
+	{"multi",	bench_multi},
+	{"index",	bench_index},
+	{"walk",	bench_walk},
+	{"paths",	bench_paths},
+	{"group",	bench_group},
+	{"order",	bench_order},
+	{NULL,		NULL}
+};
+
+/*
+ * All life begins here...
+ */
+int
+main(int argc, char *argv[])
+{
+	struct bench *bp;
+
+	if (argc < 2)
+		usage();
+	for (bp = benchmarks; bp->name != NULL; bp++)
+		if (strcmp(bp->name, argv[1]) == 0)
+			exit(bp->func(argc - 2, argv + 2));
+	usage();
+	return(0);
+}
+
+/*
+ * Hash every file given on the command line, first in-process and then
+ * the old way through popen(), and report the files hashed per second.
+ * The two digests are compared as we go, just to be sure.
+ */
+int
+bench_hash(int argc, char *argv[])
+{
+	int i;
+	FILE *pp;
+	double t0, t_in, t_popen;
+	char cmd[4096], line[4096], hex[SHA256_DIGEST_SIZE * 2 + 1];
+	unsigned char digest[SHA256_DIGEST_SIZE];
+
+	if (argc < 1)
+		usage();
+	t0 = now();
+	for (i = 0; i < argc; i++) {
+		if (hash_file(argv[i], digest) < 0) {
+			perror(argv[i]);
+			return(1);
+		}
+	}
+	t_in = now() - t0;
+	t_popen = 0.0;
+	for (i = 0; i < argc; i++) {
+		t0 = now();
+		snprintf(cmd, sizeof(cmd), "%s \"%s\"", HASH_COMMAND, argv[i]);
+		if ((pp = popen(cmd, "r")) == NULL || fgets(line, sizeof(line), pp) == NULL) {
+			perror(cmd);
+			return(1);
+		}
+		pclose(pp);
+		t_popen += now() - t0;
+		hash_file(argv[i], digest);
+		hash_hex(digest, SHA256_DIGEST_SIZE, hex);
+		if (strncmp(line, hex, SHA256_DIGEST_SIZE * 2) != 0) {
+			fprintf(stderr, "Digest mismatch for %s!\n", argv[i]);
+			return(1);
+		}
+	}
+	printf("in-process: %d files in %.3fs (%.1f files/s)\n", argc, t_in, argc / t_in);
+	printf("popen:      %d files in %.3fs (%.1f files/s)\n", argc, t_popen, argc / t_popen);
+	return(0);
+}
+
+/*
+ * Hash the files on the command line with each of the readers (-R),
+ * starting each time with none of them in the page cache, and report
+ * the throughput and how much of them is still cached afterwards. That
+ * last is the page cache pollution: what a big scan pushes everything
+ * else out to make room for. The digests are checked against the
+ * first reader's, just to be sure.
+ */
+int
+bench_reader(int argc, char *argv[])
+{
+	int i, r;
+	size_t total, cached;
+	double t0, t;
+	unsigned char (*digests)[HASH_MAX_DIGEST], digest[HASH_MAX_DIGEST];
+
+	if (argc < 1)
+		usage();
+	if ((digests = malloc(argc * sizeof(*digests))) == NULL) {
+		perror("bench_reader malloc");
+		return(1);
+	}
+	for (r = 0; hash_readers[r] != NULL; r++) {
+		hash_reader = HASH_READ_PLAIN;
+		for (total = i = 0; i < argc; i++)
+			cached_bytes(argv[i], 1, &total);
+		hash_reader = r;
+		t0 = now();
+		for (i = 0; i < argc; i++) {
+			if (hash_file(argv[i], r == 0 ? digests[i] : digest) < 0) {
+				perror(argv[i]);
+				return(1);
+			}
+			if (r > 0 && !digest_equal(digest, digests[i])) {
+				fprintf(stderr, "Digest mismatch for %s!\n", argv[i]);
+				return(1);
+			}
+		}
+		t = now() - t0;
+		for (cached = i = 0; i < argc; i++)
+			cached += cached_bytes(argv[i], 0, NULL);
+		printf("%-8s %8.1f MiB/s, %8.1f of %.1f MiB left in the page cache (%.0f%%)\n",
+				hash_readers[r], total / t / 1048576.0, cached / 1048576.0,
+				total / 1048576.0, total > 0 ? cached * 100.0 / total : 0.0);
+	}
+	hash_reader = HASH_READ_PLAIN;
+	free((void *)digests);
+	return(0);
+}
+
+/*
+ * How much of a file is in the page cache (by mincore() on a mapping
+ * of it). With "drop", have it dropped from the cache first. The size
+ * of the file is added to *totalp, if that's given.
+ */
+size_t
+cached_bytes(const char *path, int drop, size_t *totalp)
+{
+	int fd;
+	size_t i, n, pagesize, cached;
+	unsigned char *vec;
+	void *p;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (totalp != NULL)
+		*totalp += st.st_size;
+	if (drop)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (st.st_size == 0) {
+		close(fd);
+		return(0);
+	}
+	pagesize = sysconf(_SC_PAGESIZE);
+	n = (st.st_size + pagesize - 1) / pagesize;
+	if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ||
+			(vec = (unsigned char *)malloc(n)) == NULL || mincore(p, st.st_size, vec) < 0) {
+		perror("cached_bytes");
+		exit(1);
+	}
+	for (cached = i = 0; i < n; i++)
+		cached += (vec[i] & 1) * pagesize;
+	free((void *)vec);
+	munmap(p, st.st_size);
+	close(fd);
+	return(cached);
+}
+
+/*
+ * Run each SHA-256 kernel the CPU supports over the same in-memory
+ * buffer (256 MiB by default) and report the throughput. The digests
+ * must all agree with the portable kernel.
+ */
+int
+bench_kernels(int argc, char *argv[])
+{
+	size_t i, len;
+	double t0, t;
+	unsigned char *buf, digest[SHA256_DIGEST_SIZE], ref[SHA256_DIGEST_SIZE];
+	struct sha256_ctx ctx;
+	struct sha256_kernel *kp;
+
+	len = (argc > 0 ? atoi(argv[0]) : 256) * 1024UL * 1024UL;
+	if ((buf = (unsigned char *)malloc(len)) == NULL) {
+		perror("bench_kernels malloc");
+		return(1);
+	}
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)(i * 2654435761U >> 13);
+	sha256_select("scalar");
+	sha256_init(&ctx);
+	sha256_update(&ctx, buf, len);
+	sha256_final(&ctx, ref);
+	for (kp = sha256_kernels; kp->name != NULL; kp++) {
+		if (sha256_select(kp->name) < 0) {
+			printf("%-8s not supported\n", kp->name);
+			continue;
+		}
+		t0 = now();
+		sha256_init(&ctx);
+		sha256_update(&ctx, buf, len);
+		sha256_final(&ctx, digest);
+		t = now() - t0;
+		printf("%-8s %6.3f GB/s%s\n", kp->name, len / t / 1e9,
+				memcmp(digest, ref, sizeof(ref)) == 0 ? "" : "  DIGEST MISMATCH");
+	}
+	free(buf);
+	return(0);
+}
+
+/*
+ * Run each of the hash algorithms over the same in-memory buffer and
+ * report the throughput.
+ */
+int
+bench_algos(int argc, char *argv[])
+{
+	size_t i, len;
+	double t0, t;
+	unsigned char *buf, digest[HASH_MAX_DIGEST];
+	union hash_ctx ctx;
+	struct hash_algo *hp;
+
+	len = (argc > 0 ? atoi(argv[0]) : 256) * 1024UL * 1024UL;
+	if ((buf = (unsigned char *)malloc(len)) == NULL) {
+		perror("bench_algos malloc");
+		return(1);
+	}
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)(i * 2654435761U >> 13);
+	for (hp = hash_algos; hp->name != NULL; hp++) {
+		t0 = now();
+		hp->init(&ctx);
+		hp->update(&ctx, buf, len);
+		hp->final(&ctx, digest);
+		t = now() - t0;
+		printf("%-8s %6.3f GB/s\n", hp->name, len / t / 1e9);
+	}
+	free(buf);
+	return(0);
+}
+
+/*
+ * Hash "n" same-sized messages (default 16 x 4 KiB, like a directory
+ * full of thumbnails) many times over, first one at a time with the
+ * current single-stream kernel and then through each multi-buffer
+ * kernel. Reports messages per second and checks the digests agree.
+ */
+int
+bench_multi(int argc, char *argv[])
+{
+	int i, n, iter, niter, bad;
+	size_t j, len;
+	double t0, t;
+	unsigned char *buf, (*ref)[SHA256_DIGEST_SIZE], digest[SHA256_DIGEST_SIZE];
+	const unsigned char *data[SHA256_MAX_MULTI];
+	struct sha256_ctx ctxs[SHA256_MAX_MULTI], *cp[SHA256_MAX_MULTI];
+	struct sha256_mb_kernel *kp;
+
+	n = argc > 0 ? atoi(argv[0]) : 16;
+	len = (argc > 1 ? atoi(argv[1]) : 4) * 1024UL;
+	if (n < 1 || n > SHA256_MAX_MULTI)
+		usage();
+	niter = (int)(256UL * 1024 * 1024 / (n * len)) + 1;
+	buf = (unsigned char *)malloc(n * len);
+	ref = malloc(n * sizeof(*ref));
+	if (buf == NULL || ref == NULL) {
+		perror("bench_multi malloc");
+		return(1);
+	}
+	for (j = 0; j < n * len; j++)
+		buf[j] = (unsigned char)(j * 2654435761U >> 13);
+	for (i = 0; i < n; i++) {
+		data[i] = buf + i * len;
+		cp[i] = &ctxs[i];
+	}
+	t0 = now();
+	for (iter = 0; iter < niter; iter++) {
+		for (i = 0; i < n; i++) {
+			sha256_init(&ctxs[i]);
+			sha256_update(&ctxs[i], data[i], len);
+			sha256_final(&ctxs[i], ref[i]);
+		}
+	}
+	t = now() - t0;
+	printf("%-8s %10.0f msgs/s  %6.3f GB/s\n", sha256_current()->name,
+			niter * n / t, niter * n * len / t / 1e9);
+	for (kp = sha256_mb_kernels; kp->name != NULL; kp++) {
+		if (sha256_mb_select(kp->name) < 0) {
+			printf("%-8s not supported\n", kp->name);
+			continue;
+		}
+		t0 = now();
+		for (bad = iter = 0; iter < niter; iter++) {
+			for (i = 0; i < n; i++)
+				sha256_init(&ctxs[i]);
+			sha256_update_multi(cp, n, data, len);
+			for (i = 0; i < n; i++) {
+				sha256_final(&ctxs[i], digest);
+				bad |= memcmp(digest, ref[i], sizeof(digest));
+			}
+		}
+		t = now() - t0;
+		printf("%-8s %10.0f msgs/s  %6.3f GB/s%s\n", kp->name, niter * n / t,
+				niter * n * len / t / 1e9, bad ? "  DIGEST MISMATCH" : "");
+	}
+	free(buf);
+	free(ref);
+	return(0);
+}
+
+/*
+ * Insert "n" file sizes into the size index, then look them all up
+ * again, for n from 10,000 up to "max" (default 10M). The sizes are
+ * drawn so that about one in five repeats an earlier one. Also runs
+ * the old scheme (1049 sorted chains) while it's still bearable.
+ */
+#define OLD_HASH_SIZE	1049
+#define OLD_MAX		200000
+
+struct	old_entry	{
+	struct old_entry	*next;
+	uint64_t		size;
+};
+
+int
+bench_index(int argc, char *argv[])
+{
+	size_t i, n, max, found;
+	uint64_t *sizes, x;
+	double t0, t_ins, t_look, t_old;
+	void **vp;
+	struct size_index idx;
+	struct old_entry **old, *oe, **opp, *list[OLD_HASH_SIZE];
+
+	max = argc > 0 ? strtoul(argv[0], NULL, 10) : 10000000;
+	if (max < 10000)
+		usage();
+	sizes = (uint64_t *)malloc(max * sizeof(*sizes));
+	old = (struct old_entry **)malloc(OLD_MAX * sizeof(*old));
+	if (sizes == NULL || old == NULL) {
+		perror("bench_index malloc");
+		return(1);
+	}
+	printf("%10s %10s %12s %12s %12s\n", "entries", "sizes", "insert ns", "lookup ns", "old ns");
+	for (n = 10000;; n *= 10) {
+		if (n > max)
+			n = max;
+		for (i = 0, x = 1; i < n; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			sizes[i] = 1 + x % (n * 4);
+		}
+		sidx_init(&idx, 0);
+		t0 = now();
+		for (i = 0; i < n; i++) {
+			vp = sidx_insert(&idx, sizes[i]);
+			*vp = (void *)((uintptr_t)*vp + 1);
+		}
+		t_ins = now() - t0;
+		t0 = now();
+		for (found = i = 0; i < n; i++)
+			found += sidx_lookup(&idx, sizes[i]) != NULL;
+		t_look = now() - t0;
+		if (found != n)
+			printf("LOOKUP FAILED (%lu of %lu)\n", found, n);
+		t_old = 0.0;
+		if (n <= OLD_MAX) {
+			for (i = 0; i < OLD_HASH_SIZE; i++)
+				list[i] = NULL;
+			for (i = 0; i < n; i++)
+				if ((old[i] = (struct old_entry *)malloc(sizeof(struct old_entry))) == NULL) {
+					perror("bench_index malloc");
+					return(1);
+				}
+			t0 = now();
+			for (i = 0; i < n; i++) {
+				for (opp = &list[sizes[i] % OLD_HASH_SIZE]; (oe = *opp) != NULL && oe->size <= sizes[i]; opp = &oe->next)
+					;
+				old[i]->size = sizes[i];
+				old[i]->next = *opp;
+				*opp = old[i];
+			}
+			t_old = now() - t0;
+			for (i = 0; i < n; i++)
+				free((void *)old[i]);
+		}
+		printf("%10lu %10lu %12.1f %12.1f ", n, idx.count, t_ins / n * 1e9, t_look / n * 1e9);
+		if (t_old > 0.0)
+			printf("%12.1f\n", t_old / n * 1e9);
+		else
+			printf("%12s\n", "-");
+		sidx_free(&idx);
+		if (n == max)
+			break;
+	}
+	free((void *)sizes);
+	free((void *)old);
+	return(0);
+}
+
+/*
+ * Walk a tree with 1, 2, 4... threads, up to "max" (default 64), and
+ * report directories and entries per second. The first pass is just
+ * to warm the inode and dentry caches, so the numbers are for metadata
+ * which is already in memory unless the caches are dropped in between.
+ */
+long	walk_files[WALK_MAX_THREADS];
+
+int
+bench_walk(int argc, char *argv[])
+{
+	int i, n, max;
+	long files;
+	struct walk_stats ws;
+
+	if (argc < 1)
+		usage();
+	max = argc > 1 ? atoi(argv[1]) : WALK_MAX_THREADS;
+	if (max < 1 || max > WALK_MAX_THREADS)
+		usage();
+	walk_tree(argv[0], 1, 0, walk_count, &ws);
+	printf("%8s %10s %12s %12s %12s\n", "threads", "files", "secs", "dirs/s", "entries/s");
+	for (n = 1;; n *= 2) {
+		if (n > max)
+			n = max;
+		for (i = 0; i < WALK_MAX_THREADS; i++)
+			walk_files[i] = 0;
+		walk_tree(argv[0], n, 0, walk_count, &ws);
+		for (files = 0, i = 0; i < n; i++)
+			files += walk_files[i];
+		printf("%8d %10ld %12.3f %12.0f %12.0f\n", n, files, ws.elapsed,
+				ws.dirs / ws.elapsed, ws.entries / ws.elapsed);
+		if (n == max)
+			break;
+	}
+	return(0);
+}
+
+/*
+ * Count a file found by the walk.
+ */
+void
+walk_count(int tid, struct dirnode *dir, const char *name, struct stat *sp)
+{
+	walk_files[tid]++;
+}
+
+/*
+ * Store "n" paths (default 1M) from a made-up tree - a hundred files
+ * to a directory, ten subdirectories to a directory - first as full
+ * strings, the way entries used to hold them, then as directory nodes
+ * and names. Reports the heap used per path, the time to store them,
+ * and the time to build the full path again from the nodes.
+ */
+#define BP_FILES	100
+#define BP_FANOUT	10
+#define BP_ROOT		"/home/someone/projects/archive"
+
+int
+bench_paths(int argc, char *argv[])
+{
+	int d, depth, fresh;
+	size_t i, n, leaf, h0, h_old, h_new, *scale, *digit;
+	char name[64], buf[PATH_MAX], **old;
+	double t0, t_old, t_new, t_build;
+	struct dirnode *dir, **dirs;
+	struct pathref *refs;
+
+	n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1000000;
+	if (n < BP_FILES)
+		usage();
+	for (depth = 1, i = BP_FANOUT; i < n / BP_FILES; i *= BP_FANOUT)
+		depth++;
+	scale = (size_t *)malloc((depth + 1) * sizeof(size_t));
+	digit = (size_t *)malloc((depth + 1) * sizeof(size_t));
+	if (scale == NULL || digit == NULL) {
+		perror("bench_paths malloc");
+		return(1);
+	}
+	for (scale[depth] = 1, d = depth - 1; d > 0; d--)
+		scale[d] = scale[d + 1] * BP_FANOUT;
+	/*
+	 * The old way.
+	 */
+	h0 = heap_used();
+	t0 = now();
+	if ((old = (char **)malloc(n * sizeof(char *))) == NULL) {
+		perror("bench_paths malloc");
+		return(1);
+	}
+	for (i = 0; i < n; i++) {
+		strcpy(buf, BP_ROOT);
+		for (leaf = i / BP_FILES, d = 1; d <= depth; d++)
+			sprintf(buf + strlen(buf), "/dir%02lu", leaf / scale[d] % BP_FANOUT);
+		sprintf(buf + strlen(buf), "/file%05lu.dat", i % BP_FILES);
+		if ((old[i] = strdup(buf)) == NULL) {
+			perror("bench_paths strdup");
+			return(1);
+		}
+	}
+	t_old = now() - t0;
+	h_old = heap_used() - h0;
+	for (i = 0; i < n; i++)
+		free((void *)old[i]);
+	free((void *)old);
+	/*
+	 * The new way. Directories are created as a scan would find
+	 * them, so each leaf directory only gets one node.
+	 */
+	h0 = heap_used();
+	t0 = now();
+	refs = (struct pathref *)malloc(n * sizeof(struct pathref));
+	dirs = (struct dirnode **)calloc(depth + 1, sizeof(struct dirnode *));
+	if (refs == NULL || dirs == NULL) {
+		perror("bench_paths malloc");
+		return(1);
+	}
+	dirs[0] = path_dir(0, NULL, BP_ROOT);
+	for (dir = NULL, i = 0; i < n; i++) {
+		if (i % BP_FILES == 0) {
+			for (leaf = i / BP_FILES, fresh = 0, d = 1; d <= depth; d++) {
+				if (!fresh && dirs[d] != NULL && digit[d] == leaf / scale[d] % BP_FANOUT)
+					continue;
+				digit[d] = leaf / scale[d] % BP_FANOUT;
+				sprintf(name, "dir%02lu", digit[d]);
+				dirs[d] = path_dir(0, dirs[d - 1], name);
+				fresh = 1;
+			}
+			dir = dirs[depth];
+		}
+		sprintf(name, "file%05lu.dat", i % BP_FILES);
+		refs[i].dir = dir;
+		refs[i].name = path_name(0, name);
+	}
+	t_new = now() - t0;
+	h_new = heap_used() - h0;
+	t0 = now();
+	for (i = 0; i < n; i++)
+		path_build(refs[i].dir, refs[i].name, buf);
+	t_build = now() - t0;
+	printf("%lu paths, %d directories deep, e.g. %s\n", n, depth, buf);
+	printf("full paths:  %10.1f MiB  %6.1f bytes/path  %6.1f ns/path\n",
+			h_old / 1048576.0, (double)h_old / n, t_old / n * 1e9);
+	printf("dir nodes:   %10.1f MiB  %6.1f bytes/path  %6.1f ns/path  (rebuild %.1f ns/path)\n",
+			h_new / 1048576.0, (double)h_new / n, t_new / n * 1e9, t_build / n * 1e9);
+	free((void *)refs);
+	free((void *)dirs);
+	free((void *)scale);
+	free((void *)digit);
+	return(0);
+}
+
+/*
+ * Group "n" files (default 1M) by size and find the hard links among
+ * them, the old way and the new. The old way is an entry per file, as
+ * dupscan first had them (malloc()ed, 56 bytes), on hashed linked lists
+ * which are walked to find the groups. The new way is the columnar
+ * store (-c), sorted and then scanned along, with the inode set for the
+ * links. Sizes are drawn as for "bench index", and every fiftieth file
+ * is another link to the one before it. The lists aren't freed until
+ * the end, so the columns don't just get the same memory back.
+ */
+#define BG_LINKS	50
+
+struct	list_entry	{
+	struct list_entry	*next;
+	char			*path;
+	size_t			size;
+	char			*hash;
+	nlink_t			nlinks;
+	dev_t			device;
+	ino_t			inode;
+};
+
+int
+bench_group(int argc, char *argv[])
+{
+	size_t i, j, k, n, nchains, h0, h_list, h_col, groups[2], links[2];
+	uint64_t x, *sizes;
+	uint32_t *vp;
+	double t0, t_list[2], t_col[2];
+	struct list_entry **chains, *lp, *lq, *lr;
+	struct columns cols;
+	struct inoset inodes;
+
+	n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1000000;
+	if (n < 1000)
+		usage();
+	nchains = n / 4;
+	sizes = (uint64_t *)malloc(n * sizeof(*sizes));
+	chains = (struct list_entry **)calloc(nchains, sizeof(*chains));
+	if (sizes == NULL || chains == NULL) {
+		perror("bench_group malloc");
+		return(1);
+	}
+	for (i = 0, x = 1; i < n; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		sizes[i] = i % BG_LINKS == 0 && i > 0 ? sizes[i - 1] : 1 + x % (n * 4);
+	}
+	/*
+	 * The old way. The hash field marks entries already counted.
+	 */
+	h0 = heap_used();
+	t0 = now();
+	for (i = 0; i < n; i++) {
+		if ((lp = (struct list_entry *)malloc(sizeof(*lp))) == NULL) {
+			perror("bench_group malloc");
+			return(1);
+		}
+		lp->path = lp->hash = NULL;
+		lp->size = sizes[i];
+		lp->nlinks = (i + 1) % BG_LINKS == 0 || (i % BG_LINKS == 0 && i > 0) ? 2 : 1;
+		lp->device = 1;
+		lp->inode = i % BG_LINKS == 0 && i > 0 ? i - 1 : i;
+		lp->next = chains[lp->size % nchains];
+		chains[lp->size % nchains] = lp;
+	}
+	t_list[0] = now() - t0;
+	h_list = heap_used() - h0;
+	t0 = now();
+	for (groups[0] = links[0] = 0, i = 0; i < nchains; i++) {
+		for (lp = chains[i]; lp != NULL; lp = lp->next) {
+			if (lp->hash != NULL)
+				continue;
+			for (j = 1, lq = lp->next; lq != NULL; lq = lq->next) {
+				if (lq->size != lp->size)
+					continue;
+				lq->hash = (char *)lp;
+				if (lq->nlinks > 1)
+					for (lr = lp; lr != lq; lr = lr->next)
+						if (lr->size == lq->size && lr->device == lq->device &&
+						    lr->inode == lq->inode) {
+							links[0]++;
+							break;
+						}
+				j++;
+			}
+			if (j > 1)
+				groups[0]++;
+		}
+	}
+	t_list[1] = now() - t0;
+	/*
+	 * The new way.
+	 */
+	memset(&cols, 0, sizeof(cols));
+	inoset_init(&inodes);
+	h0 = heap_used();
+	t0 = now();
+	for (i = 0; i < n; i++)
+		col_add(&cols, sizes[i], 1, i % BG_LINKS == 0 && i > 0 ? i - 1 : i,
+				(i + 1) % BG_LINKS == 0 || (i % BG_LINKS == 0 && i > 0) ? 2 : 1,
+				0, 0, 0, NULL, NULL);
+	t_col[0] = now() - t0;
+	h_col = heap_used() - h0;
+	t0 = now();
+	col_sort(&cols);
+	for (groups[1] = links[1] = 0, i = 0; i < n; i = j) {
+		if ((i = col_next_run(&cols, i)) == n)
+			break;
+		j = col_run_end(&cols, i);
+		for (k = i; k < j; k++) {
+			if (cols.nlink[cols.row[k]] < 2)
+				continue;
+			vp = inoset_insert(&inodes, cols.device[cols.row[k]], cols.inode[cols.row[k]]);
+			if (*vp != INOSET_EMPTY)
+				links[1]++;
+			else
+				*vp = cols.row[k];
+		}
+		groups[1]++;
+	}
+	t_col[1] = now() - t0;
+	col_free(&cols);
+	inoset_free(&inodes);
+	for (i = 0; i < nchains; i++)
+		for (lp = chains[i]; lp != NULL; lp = lq) {
+			lq = lp->next;
+			free((void *)lp);
+		}
+	printf("%lu files, %lu same-size groups, %lu hard links%s\n", n, groups[1], links[1],
+			groups[0] != groups[1] || links[0] != links[1] ? "  MISMATCH" : "");
+	printf("lists:    %6.1f bytes/file  collect %6.1f ns/file  group %6.1f ns/file\n",
+			(double)h_list / n, t_list[0] / n * 1e9, t_list[1] / n * 1e9);
+	printf("columns:  %6.1f bytes/file  collect %6.1f ns/file  group %6.1f ns/file\n",
+			(double)h_col / n, t_col[0] / n * 1e9, t_col[1] / n * 1e9);
+	free((void *)sizes);
+	free((void *)chains);
+	return(0);
+}
+
+/*
+ * Read every file under a directory in the order the walk finds them,
+ * then in physical order (by the first extent, as -P does), and report
+ * the seeks each would cost a spinning disk. The disk is modelled: a
+ * seek is a rotation (half a turn at 7200rpm, on average) plus a head
+ * movement which grows with the square root of the distance, up to
+ * "stroke" ms (default 15) for the width of what's being read. Each
+ * order is also timed for real, from a cold page cache, which is the
+ * number to go by on a real disk (or a loopback image on one).
+ */
+#define ORDER_EXTENTS	64
+#define ORDER_ROTATE	4.17
+
+struct	ofile	{
+	char		*path;
+	uint64_t	phys[ORDER_EXTENTS];
+	uint64_t	lens[ORDER_EXTENTS];
+	int		n;
+};
+
+struct ofile	*ofiles = NULL;
+size_t		nofiles, max_ofiles;
+
+int
+bench_order(int argc, char *argv[])
+{
+	int pass, j;
+	size_t i, seeks, none;
+	uint64_t pos, lo, hi, travel;
+	double stroke, model, t0, t;
+	unsigned char digest[HASH_MAX_DIGEST];
+	struct walk_stats ws;
+	struct ofile *fp, **order;
+
+	if (argc < 1)
+		usage();
+	stroke = argc > 1 ? atof(argv[1]) : 15.0;
+	walk_tree(argv[0], 1, 0, order_add, &ws);
+	if ((order = (struct ofile **)malloc(nofiles * sizeof(*order))) == NULL) {
+		perror("bench_order malloc");
+		return(1);
+	}
+	for (lo = EXTENT_NONE, hi = none = i = 0; i < nofiles; i++) {
+		fp = &ofiles[i];
+		if ((fp->n = extent_all(fp->path, fp->phys, fp->lens, ORDER_EXTENTS)) < 0) {
+			perror(fp->path);
+			return(1);
+		}
+		if (fp->n == 0 || fp->phys[0] == EXTENT_NONE)
+			none++;
+		for (j = 0; j < fp->n; j++) {
+			if (fp->phys[j] == EXTENT_NONE)
+				continue;
+			if (fp->phys[j] < lo)
+				lo = fp->phys[j];
+			if (fp->phys[j] + fp->lens[j] > hi)
+				hi = fp->phys[j] + fp->lens[j];
+		}
+		order[i] = fp;
+	}
+	printf("%lu files (%lu with no extents), spread over %.1f GiB of disk\n",
+			(unsigned long)nofiles, (unsigned long)none, hi > lo ? (hi - lo) / 1073741824.0 : 0.0);
+	hash_select("xxh3");
+	sync();
+	printf("%-10s %10s %12s %12s %12s\n", "order", "seeks", "travel GiB", "model secs", "real secs");
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1)
+			qsort(order, nofiles, sizeof(*order), order_cmp);
+		for (seeks = travel = 0, pos = lo, model = 0.0, i = 0; i < nofiles; i++) {
+			fp = order[i];
+			for (j = 0; j < fp->n; j++) {
+				if (fp->phys[j] == EXTENT_NONE || fp->phys[j] == pos)
+					continue;
+				seeks++;
+				travel += fp->phys[j] > pos ? fp->phys[j] - pos : pos - fp->phys[j];
+				model += ORDER_ROTATE + stroke * sqrt((double)(fp->phys[j] > pos ?
+						fp->phys[j] - pos : pos - fp->phys[j]) / (hi - lo));
+				pos = fp->phys[j] + fp->lens[j];
+			}
+		}
+		for (i = 0; i < nofiles; i++)
+			cached_bytes(order[i]->path, 1, NULL);
+		t0 = now();
+		for (i = 0; i < nofiles; i++) {
+			if (hash_file(order[i]->path, digest) < 0) {
+				perror(order[i]->path);
+				return(1);
+			}
+		}
+		t = now() - t0;
+		printf("%-10s %10lu %12.1f %12.3f %12.3f\n", pass == 0 ? "discovery" : "physical",
+				(unsigned long)seeks, travel / 1073741824.0, model / 1000.0, t);
+	}
+	free((void *)order);
+	return(0);
+}
+
+/*
+ * Keep each non-empty regular file the walk finds.
+ */
+void
+order_add(int tid, struct dirnode *dir, const char *name, struct stat *sp)
+{
+	char buf[PATH_MAX];
+
+	if (sp->st_size == 0)
+		return;
+	if (nofiles == max_ofiles) {
+		max_ofiles = max_ofiles == 0 ? 1024 : max_ofiles * 2;
+		if ((ofiles = (struct ofile *)realloc(ofiles, max_ofiles * sizeof(*ofiles))) == NULL) {
+			perror("order_add realloc");
+			exit(1);
+		}
+	}
+	if ((ofiles[nofiles++].path = strdup(path_build(dir, name, buf))) == NULL) {
+		perror("order_add strdup");
+		exit(1);
+	}
+}
+
+/*
+ * By first extent, as -P does it (files with none go last).
+ */
+int
+order_cmp(const void *p1, const void *p2)
+{
+	const struct ofile *fp1 = *(struct ofile **)p1, *fp2 = *(struct ofile **)p2;
+	uint64_t x1, x2;
+
+	x1 = fp1->n > 0 ? fp1->phys[0] : EXTENT_NONE;
+	x2 = fp2->n > 0 ? fp2->phys[0] : EXTENT_NONE;
+	return(x1 < x2 ? -1 : x1 > x2);
+}
+
+/*
+ * Bytes of heap in use, including big blocks malloc() has mmap()ed.
+ */
+size_t
+heap_used()
+{
+	struct mallinfo2 mi;
+
+	mi = mallinfo2();
+	return(mi.uordblks + mi.hblkhd);
+}
+
+/*
+ * Monotonic time, in seconds.
+ */
+double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Print a usage message and exit.
+ */
+void
+usage()
+{
+	struct bench *bp;
+
+	fprintf(stderr, "Usage: bench <benchmark> [args]\nBenchmarks:");
+	for (bp = benchmarks; bp->name != NULL; bp++)
+		fprintf(stderr, " %s", bp->name);
+	fprintf(stderr, "\n");
+	exit(2);
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * BLAKE3, following the reference implementation by O'Connor, Aumasson,
+ * Neves and Wilcox-O'Hearn (CC0/Apache). The input is split into 1 KiB
+ * chunks, each chunk is hashed to a chaining value, and the chaining
+ * values are merged pairwise up a binary tree. We keep a stack of the
+ * subtrees completed so far, and merge whenever the chunk count says
+ * two of them are the same size.
+ *
+ * Because the chunks are independent, several can be hashed at once in
+ * SIMD lanes (the "tree mode" that makes BLAKE3 quick). Whenever we have
+ * a vector's worth of whole chunks in hand - and more input after them,
+ * since the last chunk may turn out to be the root - they're done that
+ * way. Everything else goes through the portable code.
+ */
+#include <string.h>
+
+#include "blake3.h"
+
+#define CHUNK_START	0x01
+#define CHUNK_END	0x02
+#define PARENT		0x04
+#define ROOT		0x08
+
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * The quarter-round and full round. These work equally well on plain
+ * words and on vectors of words.
+ */
+#define G(v, a, b, c, d, x, y) do {					\
+	v[a] = v[a] + v[b] + (x); v[d] = ROTR32(v[d] ^ v[a], 16);	\
+	v[c] = v[c] + v[d];       v[b] = ROTR32(v[b] ^ v[c], 12);	\
+	v[a] = v[a] + v[b] + (y); v[d] = ROTR32(v[d] ^ v[a], 8);	\
+	v[c] = v[c] + v[d];       v[b] = ROTR32(v[b] ^ v[c], 7);	\
+} while (0)
+
+#define ROUND(v, m, s) do {						\
+	G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);				\
+	G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);				\
+	G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);				\
+	G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);				\
+	G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);				\
+	G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);				\
+	G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);				\
+	G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);				\
+} while (0)
+
+static const uint32_t blake3_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * The message word order for each of the seven rounds.
+ */
+static const unsigned char blake3_sched[7][16] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+	{3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+	{10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+	{12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+	{9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+	{11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+/*
+ * A node waiting to be compressed. Either the end of a chunk or a
+ * parent, and possibly the root.
+ */
+struct	output	{
+	uint32_t	cv[8];
+	uint32_t	block[16];
+	uint64_t	counter;
+	uint32_t	blen;
+	uint32_t	flags;
+};
+
+static inline uint32_t
+load_le32(const unsigned char *cp)
+{
+	return((uint32_t)cp[0] | ((uint32_t)cp[1] << 8) | ((uint32_t)cp[2] << 16) | ((uint32_t)cp[3] << 24));
+}
+
+typedef uint32_t	v4u32 __attribute__((vector_size(16)));
+typedef uint32_t	v8u32 __attribute__((vector_size(32)));
+typedef uint32_t	v16u32 __attribute__((vector_size(64)));
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define MB_FUNC	blake3_chunks_x4
+#  define MB_VEC	v4u32
+#  define MB_LANES	4
+#  define MB_TARGET	"sse2"
+#  include "blake3_mb.h"
+#  define MB_FUNC	blake3_chunks_x8
+#  define MB_VEC	v8u32
+#  define MB_LANES	8
+#  define MB_TARGET	"avx2"
+#  include "blake3_mb.h"
+#  define MB_FUNC	blake3_chunks_x16
+#  define MB_VEC	v16u32
+#  define MB_LANES	16
+#  define MB_TARGET	"avx512f"
+#  include "blake3_mb.h"
+#elif defined(__aarch64__)
+#  define MB_FUNC	blake3_chunks_x4
+#  define MB_VEC	v4u32
+#  define MB_LANES	4
+#  define MB_TARGET	"arch=armv8-a"
+#  include "blake3_mb.h"
+#endif
+
+static int	blake3_lanes = 0;
+static void	(*blake3_chunks)(const unsigned char *, uint64_t, uint32_t (*)[8]);
+
+/*
+ * Pick the widest chunk-parallel kernel this CPU can run.
+ */
+static void
+blake3_select()
+{
+	blake3_lanes = 1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		blake3_chunks = blake3_chunks_x16;
+		blake3_lanes = 16;
+	} else if (__builtin_cpu_supports("avx2")) {
+		blake3_chunks = blake3_chunks_x8;
+		blake3_lanes = 8;
+	} else {
+		blake3_chunks = blake3_chunks_x4;
+		blake3_lanes = 4;
+	}
+#elif defined(__aarch64__)
+	blake3_chunks = blake3_chunks_x4;
+	blake3_lanes = 4;
+#endif
+}
+
+/*
+ * The compression function, on one block. The full 16-word result is
+ * returned, though mostly only the first 8 (the chaining value) are
+ * wanted.
+ */
+static void
+compress(const uint32_t *cv, const uint32_t *m, uint64_t counter, uint32_t blen, uint32_t flags, uint32_t *out)
+{
+	int i;
+	uint32_t v[16];
+
+	for (i = 0; i < 8; i++)
+		v[i] = cv[i];
+	for (i = 0; i < 4; i++)
+		v[i + 8] = blake3_iv[i];
+	v[12] = (uint32_t)counter;
+	v[13] = (uint32_t)(counter >> 32);
+	v[14] = blen;
+	v[15] = flags;
+	for (i = 0; i < 7; i++)
+		ROUND(v, m, blake3_sched[i]);
+	for (i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+static void
+load_block(uint32_t *m, const unsigned char *cp)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = load_le32(cp + i * 4);
+}
+
+static void
+output_cv(struct output *op, uint32_t *cv)
+{
+	uint32_t out[16];
+
+	compress(op->cv, op->block, op->counter, op->blen, op->flags, out);
+	memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+static void
+parent_output(struct output *op, const uint32_t *left, const uint32_t *right)
+{
+	memcpy(op->cv, blake3_iv, sizeof(op->cv));
+	memcpy(op->block, left, 8 * sizeof(uint32_t));
+	memcpy(op->block + 8, right, 8 * sizeof(uint32_t));
+	op->counter = 0;
+	op->blen = BLAKE3_BLOCK_LEN;
+	op->flags = PARENT;
+}
+
+static void
+chunk_init(struct blake3_chunk *cs, uint64_t counter)
+{
+	memcpy(cs->cv, blake3_iv, sizeof(cs->cv));
+	cs->counter = counter;
+	cs->buflen = 0;
+	cs->blocks = 0;
+}
+
+static size_t
+chunk_len(struct blake3_chunk *cs)
+{
+	return(cs->blocks * BLAKE3_BLOCK_LEN + cs->buflen);
+}
+
+/*
+ * Add data to the current chunk. The last block is always left in the
+ * buffer, since we don't yet know whether it's the end of the chunk.
+ */
+static void
+chunk_update(struct blake3_chunk *cs, const unsigned char *cp, size_t len)
+{
+	size_t n;
+	uint32_t m[16], out[16];
+
+	while (len > 0) {
+		if (cs->buflen == BLAKE3_BLOCK_LEN) {
+			load_block(m, cs->buf);
+			compress(cs->cv, m, cs->counter, BLAKE3_BLOCK_LEN,
+					cs->blocks == 0 ? CHUNK_START : 0, out);
+			memcpy(cs->cv, out, sizeof(cs->cv));
+			cs->blocks++;
+			cs->buflen = 0;
+		}
+		if ((n = BLAKE3_BLOCK_LEN - cs->buflen) > len)
+			n = len;
+		memcpy(cs->buf + cs->buflen, cp, n);
+		cs->buflen += n;
+		cp += n;
+		len -= n;
+	}
+}
+
+static void
+chunk_output(struct blake3_chunk *cs, struct output *op)
+{
+	unsigned char block[BLAKE3_BLOCK_LEN];
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, cs->buf, cs->buflen);
+	memcpy(op->cv, cs->cv, sizeof(op->cv));
+	load_block(op->block, block);
+	op->counter = cs->counter;
+	op->blen = cs->buflen;
+	op->flags = (cs->blocks == 0 ? CHUNK_START : 0) | CHUNK_END;
+}
+
+/*
+ * Push the chaining value of a completed chunk. "total" is the number
+ * of chunks done so far, and each trailing zero bit in it means the
+ * top two subtrees are now the same size and can be merged.
+ */
+static void
+push_cv(struct blake3_ctx *ctx, uint32_t *cv, uint64_t total)
+{
+	struct output o;
+
+	while ((total & 1) == 0) {
+		parent_output(&o, ctx->stack[--ctx->depth], cv);
+		output_cv(&o, cv);
+		total >>= 1;
+	}
+	memcpy(ctx->stack[ctx->depth++], cv, 8 * sizeof(uint32_t));
+}
+
+/*
+ * Start a new hash.
+ */
+void
+blake3_init(struct blake3_ctx *ctx)
+{
+	if (blake3_lanes == 0)
+		blake3_select();
+	chunk_init(&ctx->chunk, 0);
+	ctx->depth = 0;
+}
+
+/*
+ * Feed more data in.
+ */
+void
+blake3_update(struct blake3_ctx *ctx, const void *data, size_t len)
+{
+	int i;
+	size_t n;
+	uint64_t counter;
+	uint32_t cv[8], cvs[16][8];
+	struct output o;
+	const unsigned char *cp = data;
+
+	while (len > 0) {
+		if (chunk_len(&ctx->chunk) == BLAKE3_CHUNK_LEN) {
+			chunk_output(&ctx->chunk, &o);
+			output_cv(&o, cv);
+			counter = ctx->chunk.counter + 1;
+			push_cv(ctx, cv, counter);
+			chunk_init(&ctx->chunk, counter);
+		}
+		if (chunk_len(&ctx->chunk) == 0 && blake3_lanes > 1 &&
+				len > (size_t)blake3_lanes * BLAKE3_CHUNK_LEN) {
+			counter = ctx->chunk.counter;
+			blake3_chunks(cp, counter, cvs);
+			for (i = 0; i < blake3_lanes; i++)
+				push_cv(ctx, cvs[i], counter + i + 1);
+			chunk_init(&ctx->chunk, counter + blake3_lanes);
+			cp += blake3_lanes * BLAKE3_CHUNK_LEN;
+			len -= blake3_lanes * BLAKE3_CHUNK_LEN;
+			continue;
+		}
+		if ((n = BLAKE3_CHUNK_LEN - chunk_len(&ctx->chunk)) > len)
+			n = len;
+		chunk_update(&ctx->chunk, cp, n);
+		cp += n;
+		len -= n;
+	}
+}
+
+/*
+ * Fold the stack into the root node and produce the 32-byte digest.
+ */
+void
+blake3_final(struct blake3_ctx *ctx, unsigned char *digest)
+{
+	int i;
+	uint32_t cv[8], out[16];
+	struct output o;
+
+	chunk_output(&ctx->chunk, &o);
+	for (i = ctx->depth; i > 0; i--) {
+		output_cv(&o, cv);
+		parent_output(&o, ctx->stack[i - 1], cv);
+	}
+	compress(o.cv, o.block, o.counter, o.blen, o.flags | ROOT, out);
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = (unsigned char)out[i];
+		digest[i * 4 + 1] = (unsigned char)(out[i] >> 8);
+		digest[i * 4 + 2] = (unsigned char)(out[i] >> 16);
+		digest[i * 4 + 3] = (unsigned char)(out[i] >> 24);
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Streaming BLAKE3 (plain hash mode, 256-bit output). Same result as
+ * b3sum(1).
+ */
+#ifndef _BLAKE3_H_
+#define _BLAKE3_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLAKE3_DIGEST_SIZE	32
+#define BLAKE3_BLOCK_LEN	64
+#define BLAKE3_CHUNK_LEN	1024
+#define BLAKE3_MAX_DEPTH	54
+
+struct	blake3_chunk	{
+	uint32_t	cv[8];
+	uint64_t	counter;
+	unsigned char	buf[BLAKE3_BLOCK_LEN];
+	int		buflen;
+	int		blocks;
+};
+
+struct	blake3_ctx	{
+	struct blake3_chunk	chunk;
+	int			depth;
+	uint32_t		stack[BLAKE3_MAX_DEPTH][8];
+};
+
+void	blake3_init(struct blake3_ctx *);
+void	blake3_update(struct blake3_ctx *, const void *, size_t);
+void	blake3_final(struct blake3_ctx *, unsigned char *);
+
+#endif /* _BLAKE3_H_ */
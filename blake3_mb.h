@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Hash several whole BLAKE3 chunks at once, one per vector lane. Like
+ * sha256_mb.h, this is a template, included from blake3.c with MB_FUNC,
+ * MB_VEC, MB_LANES and MB_TARGET defined.
+ *
+ * The chunks are consecutive in memory, and chunk j gets the counter
+ * "counter + j". The chaining value of each goes into cvs[j].
+ */
+__attribute__((target(MB_TARGET)))
+static void
+MB_FUNC(const unsigned char *in, uint64_t counter, uint32_t (*cvs)[8])
+{
+	int i, j, b, r;
+	uint32_t flags;
+	const unsigned char *cp;
+	MB_VEC h[8], v[16], m[16], clo, chi, zero = {0};
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < MB_LANES; j++)
+			h[i][j] = blake3_iv[i];
+	for (j = 0; j < MB_LANES; j++) {
+		clo[j] = (uint32_t)(counter + j);
+		chi[j] = (uint32_t)((counter + j) >> 32);
+	}
+	for (b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+		for (j = 0; j < MB_LANES; j++) {
+			cp = in + j * BLAKE3_CHUNK_LEN + b * BLAKE3_BLOCK_LEN;
+			for (i = 0; i < 16; i++)
+				m[i][j] = load_le32(cp + i * 4);
+		}
+		flags = (b == 0 ? CHUNK_START : 0) |
+			(b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0);
+		for (i = 0; i < 8; i++)
+			v[i] = h[i];
+		for (i = 0; i < 4; i++)
+			v[i + 8] = zero + blake3_iv[i];
+		v[12] = clo;
+		v[13] = chi;
+		v[14] = zero + BLAKE3_BLOCK_LEN;
+		v[15] = zero + flags;
+		for (r = 0; r < 7; r++)
+			ROUND(v, m, blake3_sched[r]);
+		for (i = 0; i < 8; i++)
+			h[i] = v[i] ^ v[i + 8];
+	}
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < MB_LANES; j++)
+			cvs[j][i] = h[i][j];
+}
+
+#undef MB_FUNC
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_TARGET
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * The columnar file store, and the grouping passes over it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
+#include "columns.h"
+
+static void	*col_realloc(void *, size_t);
+
+/*
+ * Add a row. The name should already be somewhere permanent (a path
+ * arena, say).
+ */
+void
+col_add(struct columns *cp, uint64_t size, uint64_t device, uint64_t inode,
+		uint32_t nlink, int64_t mtime, int64_t ctime, int flags, struct dirnode *dir, const char *name)
+{
+	size_t i;
+
+	if ((i = cp->n) == cp->max) {
+		cp->max = cp->max == 0 ? 4096 : cp->max * 2;
+		cp->size = (uint64_t *)col_realloc(cp->size, cp->max * sizeof(uint64_t));
+		cp->device = (uint64_t *)col_realloc(cp->device, cp->max * sizeof(uint64_t));
+		cp->inode = (uint64_t *)col_realloc(cp->inode, cp->max * sizeof(uint64_t));
+		cp->nlink = (uint32_t *)col_realloc(cp->nlink, cp->max * sizeof(uint32_t));
+		cp->mtime = (int64_t *)col_realloc(cp->mtime, cp->max * sizeof(int64_t));
+		cp->ctime = (int64_t *)col_realloc(cp->ctime, cp->max * sizeof(int64_t));
+		cp->flags = (uint8_t *)col_realloc(cp->flags, cp->max * sizeof(uint8_t));
+		cp->paths = (struct pathref *)col_realloc(cp->paths, cp->max * sizeof(struct pathref));
+	}
+	cp->size[i] = size;
+	cp->device[i] = device;
+	cp->inode[i] = inode;
+	cp->nlink[i] = nlink;
+	cp->mtime[i] = mtime;
+	cp->ctime[i] = ctime;
+	cp->flags[i] = flags;
+	cp->paths[i].dir = dir;
+	cp->paths[i].name = name;
+	cp->n++;
+}
+
+/*
+ * Append the rows of "nsrc" stores to "dst" (which should be empty),
+ * and free them. If only the first has anything in it, its columns
+ * are just handed over.
+ */
+void
+col_merge(struct columns *dst, struct columns *src, int nsrc)
+{
+	int t;
+	size_t n;
+
+	for (n = 0, t = 0; t < nsrc; t++)
+		n += src[t].n;
+	if (n == src[0].n) {
+		*dst = src[0];
+		memset(&src[0], 0, sizeof(src[0]));
+		return;
+	}
+	memset(dst, 0, sizeof(*dst));
+	dst->max = n;
+	dst->size = (uint64_t *)col_realloc(NULL, n * sizeof(uint64_t));
+	dst->device = (uint64_t *)col_realloc(NULL, n * sizeof(uint64_t));
+	dst->inode = (uint64_t *)col_realloc(NULL, n * sizeof(uint64_t));
+	dst->nlink = (uint32_t *)col_realloc(NULL, n * sizeof(uint32_t));
+	dst->mtime = (int64_t *)col_realloc(NULL, n * sizeof(int64_t));
+	dst->ctime = (int64_t *)col_realloc(NULL, n * sizeof(int64_t));
+	dst->flags = (uint8_t *)col_realloc(NULL, n * sizeof(uint8_t));
+	dst->paths = (struct pathref *)col_realloc(NULL, n * sizeof(struct pathref));
+	for (t = 0; t < nsrc; t++) {
+		n = src[t].n;
+		memcpy(dst->size + dst->n, src[t].size, n * sizeof(uint64_t));
+		memcpy(dst->device + dst->n, src[t].device, n * sizeof(uint64_t));
+		memcpy(dst->inode + dst->n, src[t].inode, n * sizeof(uint64_t));
+		memcpy(dst->nlink + dst->n, src[t].nlink, n * sizeof(uint32_t));
+		memcpy(dst->mtime + dst->n, src[t].mtime, n * sizeof(int64_t));
+		memcpy(dst->ctime + dst->n, src[t].ctime, n * sizeof(int64_t));
+		memcpy(dst->flags + dst->n, src[t].flags, n * sizeof(uint8_t));
+		memcpy(dst->paths + dst->n, src[t].paths, n * sizeof(struct pathref));
+		dst->n += n;
+		col_free(&src[t]);
+	}
+}
+
+/*
+ * Free all the columns. The paths column can be kept by taking it (and
+ * setting it to NULL) first.
+ */
+void
+col_free(struct columns *cp)
+{
+	free((void *)cp->size);
+	free((void *)cp->row);
+	free((void *)cp->device);
+	free((void *)cp->inode);
+	free((void *)cp->nlink);
+	free((void *)cp->mtime);
+	free((void *)cp->ctime);
+	free((void *)cp->flags);
+	free((void *)cp->paths);
+	memset(cp, 0, sizeof(*cp));
+}
+
+/*
+ * Sort the store by size. This is an LSD radix sort, a byte at a time,
+ * of the size column with a row number to go along with each size. All
+ * eight byte histograms are built in one pass, and any byte which is
+ * the same in every row (most of the high ones) is skipped. It's a
+ * stable sort, so same-size rows stay in the order they were found.
+ */
+void
+col_sort(struct columns *cp)
+{
+	int b;
+	size_t i, n, pos, cnt, count[8][256];
+	uint64_t *key, *tkey, *swk;
+	uint32_t *row, *trow, *swr;
+
+	n = cp->n;
+	key = cp->size;
+	row = (uint32_t *)col_realloc(NULL, (n + 1) * sizeof(uint32_t));
+	for (i = 0; i < n; i++)
+		row[i] = i;
+	cp->row = row;
+	if (n < 2)
+		return;
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		for (b = 0; b < 8; b++)
+			count[b][(key[i] >> (b * 8)) & 0xff]++;
+	tkey = (uint64_t *)col_realloc(NULL, n * sizeof(uint64_t));
+	trow = (uint32_t *)col_realloc(NULL, n * sizeof(uint32_t));
+	for (b = 0; b < 8; b++) {
+		if (count[b][(key[0] >> (b * 8)) & 0xff] == n)
+			continue;
+		for (pos = i = 0; i < 256; i++) {
+			cnt = count[b][i];
+			count[b][i] = pos;
+			pos += cnt;
+		}
+		for (i = 0; i < n; i++) {
+			pos = count[b][(key[i] >> (b * 8)) & 0xff]++;
+			tkey[pos] = key[i];
+			trow[pos] = row[i];
+		}
+		swk = key; key = tkey; tkey = swk;
+		swr = row; row = trow; trow = swr;
+	}
+	free((void *)tkey);
+	free((void *)trow);
+	cp->size = key;
+	cp->row = row;
+}
+
+/*
+ * Find the start of the next run of two or more same sizes, at or after
+ * position "i" of a sorted store. Returns the number of rows if there
+ * isn't one. Most sizes are unique, so this is where the time goes,
+ * and it compares two neighbouring pairs at a time where it can.
+ */
+size_t
+col_next_run(struct columns *cp, size_t i)
+{
+	const uint64_t *sp = cp->size;
+	size_t n = cp->n;
+#if defined(__SSE2__)
+	int m;
+	__m128i a, b, eq;
+
+	/*
+	 * No 64-bit compare in SSE2, so compare the 32-bit halves and
+	 * check that both matched.
+	 */
+	for (; i + 2 < n; i += 2) {
+		a = _mm_loadu_si128((const __m128i *)(sp + i));
+		b = _mm_loadu_si128((const __m128i *)(sp + i + 1));
+		eq = _mm_cmpeq_epi32(a, b);
+		if ((m = _mm_movemask_ps(_mm_castsi128_ps(eq))) == 0)
+			continue;
+		if ((m & 0x3) == 0x3)
+			return(i);
+		if ((m & 0xc) == 0xc)
+			return(i + 1);
+	}
+#elif defined(__ARM_NEON)
+	uint64x2_t eq;
+
+	for (; i + 2 < n; i += 2) {
+		eq = vceqq_u64(vld1q_u64(sp + i), vld1q_u64(sp + i + 1));
+		if (vgetq_lane_u64(eq, 0))
+			return(i);
+		if (vgetq_lane_u64(eq, 1))
+			return(i + 1);
+	}
+#endif
+	for (; i + 1 < n; i++)
+		if (sp[i] == sp[i + 1])
+			return(i);
+	return(n);
+}
+
+/*
+ * The end of the run of same sizes starting at position "i".
+ */
+size_t
+col_run_end(struct columns *cp, size_t i)
+{
+	size_t j;
+
+	for (j = i + 1; j < cp->n && cp->size[j] == cp->size[i]; j++)
+		;
+	return(j);
+}
+
+/*
+ * realloc(), or die trying.
+ */
+static void *
+col_realloc(void *p, size_t size)
+{
+	if ((p = realloc(p, size)) == NULL) {
+		perror("columns realloc");
+		exit(1);
+	}
+	return(p);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A columnar store for the files found by the scan (-c). Each field
+ * has an array of its own, so the passes over the whole lot - sorting
+ * by size, finding the same-size runs, looking for hard links - read
+ * only the columns they need, one after the other, rather than dragging
+ * every field of every file through the cache.
+ */
+#ifndef _COLUMNS_H_
+#define _COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "paths.h"
+
+/*
+ * Row flags. COL_STALE says the size and times came from an old
+ * snapshot (-S), and may be out of date.
+ */
+#define COL_STALE	0x01
+
+/*
+ * Once the store is sorted, the size column is in size order, and
+ * row[] says which row of the other columns goes with each size. They
+ * stay where they are, since only the files with a same-size partner
+ * are ever looked at again.
+ */
+struct	columns	{
+	uint64_t	*size;
+	uint32_t	*row;
+	uint64_t	*device;
+	uint64_t	*inode;
+	uint32_t	*nlink;
+	int64_t		*mtime;
+	int64_t		*ctime;
+	uint8_t		*flags;
+	struct pathref	*paths;
+	size_t		n;
+	size_t		max;
+} __attribute__((aligned(64)));
+
+void	col_add(struct columns *, uint64_t, uint64_t, uint64_t, uint32_t,
+			int64_t, int64_t, int, struct dirnode *, const char *);
+void	col_merge(struct columns *, struct columns *, int);
+void	col_free(struct columns *);
+void	col_sort(struct columns *);
+size_t	col_next_run(struct columns *, size_t);
+size_t	col_run_end(struct columns *, size_t);
+
+#endif /* _COLUMNS_H_ */
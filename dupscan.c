@@ -28,84 +28,345 @@
  *
  * ABSTRACT
  * Scan a directory tree (Unix-only) and report duplicate files. Use the
- * POSIX directory access routines for the scan. Maintain a linked-list of
- * original files we've already seen. Use the file size as a first-pass
- * to find an existing entry, and use a sha256 hash to properly identify
- * two files with the same size.
+ * POSIX directory access routines for the scan. Maintain an index, keyed
+ * on file size, of the original files we've already seen. Use the file
+ * size as a first-pass to find an existing entry, and use a sha256 hash
+ * to properly identify two files with the same size.
  *
  * LIMITATIONS
  * 1. It doesn't like character-special or block-special devices.
- * 2. It also doesn't currently check for hard links.
- * 3. It just ignores symlinks.
- * 4. It could do a better job of storing/finding existing entries,
- *    but it works for me where I'm scanning around 500,000 files.
+ * 2. It just ignores symlinks.
  */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <getopt.h>
+#include <time.h>
 
-#define HASH_SIZE	1049
-
-#ifdef __FreeBSD__
-#  define HASH_COMMAND	"sha256"
-#else
-#  define HASH_COMMAND	"sha256sum"
-#endif
+#include "sha256.h"
+#include "hash.h"
+#include "sizeidx.h"
+#include "paths.h"
+#include "walk.h"
+#include "hashpool.h"
+#include "slab.h"
+#include "columns.h"
+#include "inoset.h"
+#include "replace.h"
+#include "hcache.h"
+#include "snapshot.h"
+#include "ratelimit.h"
+#include "extent.h"
 
 /*
  * Structure for maintaining list of already-seen, original entries.
- * Keep the dev/ino pair so we can look for hard links (in the
- * future). We keep the size as a quick test. Obviously, two files
- * cannot be the same if they have different sizes. So, start with
- * that parameter.
+ * Keep the dev/ino pair, which is what identifies a file. We keep the size
+ * as a quick test. Obviously, two files cannot be the same if they have
+ * different sizes. So, start with that parameter.
+ *
+ * There can be millions of these, so they're kept small. Entries live
+ * in a slab, and are known by index. The path is an index into paths[],
+ * and the device an index into devices[]. The sample hashes and the
+ * digest are only needed for files with a same-size partner, so they're
+ * off in a hashinfo of their own, allocated when first needed. The
+ * mtime and ctime are for -L and -D, which won't touch a file that has
+ * changed since it was scanned.
  */
 struct	entry	{
-	struct entry	*next;
-	char		*path;
-	size_t		size;
-	char		*hash;
-	nlink_t		nlinks;
-	dev_t		device;
-	ino_t		inode;
+	uint64_t	size;
+	uint64_t	inode;
+	int64_t		mtime;
+	int64_t		ctime;
+	uint32_t	device;
+	uint32_t	nlinks;
+	uint32_t	path;
+	uint32_t	info;
+	uint32_t	flags;
+};
+
+struct	hashinfo	{
+	unsigned char	digest[HASH_MAX_DIGEST] __attribute__((aligned(16)));
+	uint64_t	quick;
+	uint64_t	middle;
+};
+
+#define ENT(i)		((struct entry *)slab_ptr(&entries, (i)))
+#define PATH_DIR(ep)	(paths[(ep)->path].dir)
+#define PATH_NAME(ep)	(paths[(ep)->path].name)
+
+/*
+ * All the original entries of a given size. This is what the size
+ * index points at. The array grows as needed, and entries stay in the
+ * order they were found.
+ */
+struct	group	{
+	int		n;
+	int		max;
+	uint32_t	ent[];
+};
+
+/*
+ * A same-size group on its way through the hash pool (-w). Groups are
+ * resolved in the order they went in, once all their digests are back.
+ * The hash requests (one per entry, with a NULL path if the entry
+ * doesn't need hashing) follow the structure, then the hash cache keys
+ * for them (-C), then the entry indices.
+ */
+struct	pgroup	{
+	struct pgroup	*next;
+	int		n;
+	int		pending;
+	struct hcache_key *keys;
+	uint32_t	*ents;
+	struct hash_req	reqs[];
+};
+
+/*
+ * An entry waiting to be read in physical order (-P): where its data
+ * starts on the disk, and where it was in the group list.
+ */
+struct	porder	{
+	uint32_t	device;
+	uint32_t	ent;
+	uint64_t	phys;
+	size_t		pos;
+};
+
+/*
+ * Entry flags. These say which of the cheap prefilter hashes, and the
+ * full digest, have been computed (and cached) for the entry.
+ */
+#define E_QUICK		0x01		/* head/tail sample hash is valid */
+#define E_MIDDLE	0x02		/* middle sample hash is valid */
+#define E_HASHED	0x04		/* full digest is valid */
+#define E_CACHED	0x08		/* hash cache (-C) has been tried */
+#define E_STALE		0x10		/* size and times are from the snapshot (-S) */
+
+/*
+ * Counters for the statistics report (-s). Each stage of the
+ * comparison counts the same-size pairs it eliminated.
+ */
+struct	stats	{
+	long		files;		/* regular files examined */
+	long		unique_size;	/* no other file of that size (yet) */
+	long		groups;		/* same-size groups (-c) */
+	long		links;		/* hard links to a file already seen */
+	long		snap_dirs;	/* directories listed from the snapshot */
+	long		rej_quick;	/* pairs rejected on head/tail sample */
+	long		rej_middle;	/* pairs rejected on middle sample */
+	long		rej_hash;	/* pairs rejected on full hash */
+	long		rej_verify;	/* pairs rejected on byte compare */
+	long		hashed;		/* files hashed in full */
+	long		compared;	/* files compared in lock-step (-c) */
+	long		no_extent;	/* files with no physical extent (-P) */
+	long		dups;		/* duplicates found */
+	double		stall_submit;	/* waiting for room in the hash queue (-w) */
+	double		stall_digest;	/* waiting for digests to come back (-w) */
+	struct hcache_stats cache;	/* hash cache (-C) */
 };
 
 /*
  * Some basic variables. Verbose is used to increase the amount of
- * chat/output. no_effect allows for a dry-run, as eventually this will
- * replace the file with a symlink to the original.
+ * chat/output. link_dups (-L) replaces each duplicate with a hard link
+ * to the original, dedupe (-D) has the filesystem share their extents
+ * instead, and no_effect turns either into a dry-run.
  */
 int		verbose;
 int		no_effect;
-struct entry	*entry_list[HASH_SIZE];
-struct entry	*freelist = NULL;
+int		link_dups;
+int		dedupe;
+int		show_stats;
+int		sample_middle;
+int		verify;
+int		collect;
+int		nthreads;
+int		hash_workers;
+int		queue_depth;
+int		read_backend;
+int		physical;
+char		*cache_file;
+char		*snap_file;
+struct stats	stats;
+struct walk_stats scan;
+struct hash_pool_stats pool;
+struct replace_stats replaced;
+struct pgroup	*pipe_head = NULL, *pipe_tail = NULL;
+struct size_index size_index;
+struct inoset	inodes;
+struct slab	entries;
+struct slab	infos;
+struct columns	colbufs[WALK_MAX_THREADS];
+struct pathref	*paths = NULL;
+size_t		npaths, max_paths;
+dev_t		*devices = NULL;
+int		ndevices;
+uint32_t	*pents = NULL;
+size_t		npents, max_pents;
+size_t		*pends = NULL;
+size_t		npends, max_pends;
 
 /*
  * Prototypes.
  */
-void		scan_dups(char *);
-void		process(char *, char *);
-void		regular_file(struct entry *);
+void		scan_dups(int, char *, struct dirnode *);
+void		process(int, struct dirnode *, size_t, dev_t);
+void		regular_file(uint32_t);
+void		duplicate(uint32_t, struct entry *);
+void		collect_file(int, struct dirnode *, const char *, struct stat *);
+void		group_records();
+void		compare_entries(uint32_t *, int);
+void		physical_add(uint32_t *, int);
+void		physical_run();
+int		porder_cmp(const void *, const void *);
+void		pipe_group(uint32_t *, int);
+int		pipe_need_hash(uint32_t *, int, int);
+void		pipe_done(struct hash_req *);
+void		pipe_resolve(int);
 void		generate_hash(struct entry *);
-struct entry	*find_entry(struct entry *);
-struct entry	*entry_alloc(char *);
-void		entry_free(struct entry *);
+void		generate_hash_batch(struct entry **, int);
+struct entry	*find_entry(uint32_t);
+struct group	*group_add(struct group *, uint32_t);
+int		prefilter(struct entry *, struct entry *);
+void		sample_hash(struct entry *, int);
+int		verify_entries(struct entry *, struct entry *);
+int		cache_check(struct entry *);
+uint32_t	entry_alloc(uint32_t, uint64_t, dev_t, ino_t);
+void		entry_free(uint32_t);
+void		entry_file(struct entry *, struct replace_file *);
+int		entry_key(struct entry *, struct hcache_key *);
+struct hashinfo	*entry_info(struct entry *);
+uint32_t	path_add(struct dirnode *, const char *);
+uint32_t	device_index(dev_t);
+int		hard_link(uint32_t, dev_t, ino_t, nlink_t);
+char		*ep_path(struct entry *);
+void		kernel_list();
+void		print_stats();
+double		now();
 void		usage();
 
+/*
+ * Long options. Anything without a short equivalent gets a value
+ * outside the range of characters.
+ */
+#define OPT_VERIFY	256
+#define OPT_MAX_READ	257
+#define OPT_MAX_OPS	258
+#define OPT_LIMITS	259
+
+struct option	long_opts[] = {
+	{"verify",	no_argument,		NULL,	OPT_VERIFY},
+	{"max-read",	required_argument,	NULL,	OPT_MAX_READ},
+	{"max-ops",	required_argument,	NULL,	OPT_MAX_OPS},
+	{"limits",	required_argument,	NULL,	OPT_LIMITS},
+	{NULL,		0,			NULL,	0}
+};
+
 /*
  * All life begins here...
  */
 int
 main(int argc, char *argv[])
 {
-	int i;
+	int i, limited;
+	int64_t limit;
 
-	opterr = verbose = no_effect = 0;
-	while ((i = getopt(argc, argv, "nv")) != EOF) {
+	limited = 0;
+	opterr = verbose = no_effect = link_dups = dedupe = show_stats = sample_middle = verify = collect = physical = 0;
+	nthreads = 1;
+	hash_workers = 0;
+	queue_depth = HASH_POOL_DEPTH;
+	read_backend = HASH_POOL_PREAD;
+	cache_file = snap_file = NULL;
+	while ((i = getopt_long(argc, argv, "a:C:cDH:j:LmnO:Pq:R:S:svw:", long_opts, NULL)) != EOF) {
 		switch (i) {
+		case 'a':
+			/*
+			 * Choose the hash algorithm. SHA-256 unless
+			 * we're told otherwise.
+			 */
+			if (hash_select(optarg) < 0) {
+				fprintf(stderr, "dupscan: unknown hash algorithm '%s'.\n", optarg);
+				usage();
+			}
+			break;
+
+		case 'C':
+			/*
+			 * Keep digests in this file from one run to
+			 * the next, and don't hash a file again if
+			 * it hasn't changed.
+			 */
+			cache_file = optarg;
+			break;
+
+		case 'c':
+			/*
+			 * Collect everything first, then group by
+			 * size. Only sizes with more than one file
+			 * are looked at any further.
+			 */
+			collect = 1;
+			break;
+
+		case 'D':
+			/*
+			 * Have the filesystem share the extents of each
+			 * duplicate with the original (btrfs, XFS),
+			 * once the scan is done.
+			 */
+			dedupe = 1;
+			break;
+
+		case 'H':
+			/*
+			 * Choose the SHA-256 kernel, or list the ones
+			 * this CPU can run. Normally we just pick the
+			 * fastest one.
+			 */
+			if (strcmp(optarg, "list") == 0) {
+				kernel_list();
+				exit(0);
+			}
+			if (sha256_select(optarg) < 0 && sha256_mb_select(optarg) < 0) {
+				fprintf(stderr, "dupscan: hash kernel '%s' not available.\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case 'j':
+			/*
+			 * Scan the tree with this many threads. The
+			 * threads only collect, so this implies -c.
+			 */
+			if ((nthreads = atoi(optarg)) < 1 || nthreads > WALK_MAX_THREADS) {
+				fprintf(stderr, "dupscan: -j must be from 1 to %d.\n", WALK_MAX_THREADS);
+				exit(1);
+			}
+			if (nthreads > 1)
+				collect = 1;
+			break;
+
+		case 'L':
+			/*
+			 * Replace each duplicate with a hard link to
+			 * the original, once the scan is done.
+			 */
+			link_dups = 1;
+			break;
+
+		case 'm':
+			/*
+			 * Also compare a block from the middle of
+			 * large files before hashing them in full.
+			 */
+			sample_middle = 1;
+			break;
+
 		case 'n':
 			/*
 			 * "Claytons" mode. Don't do anything harmful
@@ -115,6 +376,75 @@ main(int argc, char *argv[])
 			no_effect = 1;
 			break;
 
+		case 'O':
+			/*
+			 * Read files of at least this size with
+			 * O_DIRECT, so hashing them doesn't push
+			 * everything else out of the page cache.
+			 */
+			if ((hash_direct_min = size_arg(optarg)) <= 0) {
+				fprintf(stderr, "dupscan: bad size '%s' for -O.\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case 'P':
+			/*
+			 * Read files in the order their data is laid
+			 * out on the disk, rather than the order they
+			 * were found. That needs everything up front,
+			 * so this implies -c.
+			 */
+			physical = 1;
+			collect = 1;
+			break;
+
+		case 'q':
+			/*
+			 * How many hash requests can be queued up
+			 * for the workers (-w).
+			 */
+			if ((queue_depth = atoi(optarg)) < 1) {
+				fprintf(stderr, "dupscan: bad queue depth '%s'.\n", optarg);
+				exit(1);
+			}
+			break;
+
+		case 'R':
+			/*
+			 * How files are read. Plain pread(), pread()
+			 * which gives the pages back to the cache as
+			 * it goes ("fadvise"), mmap(), or io_uring with
+			 * lots of files in flight at once. The io_uring
+			 * backend needs the worker pool, so it gets (at
+			 * least) one.
+			 */
+			if (strcmp(optarg, "uring") == 0)
+				read_backend = HASH_POOL_URING;
+			else if (hash_reader_select(optarg) == 0)
+				read_backend = HASH_POOL_PREAD;
+			else {
+				fprintf(stderr, "dupscan: unknown read backend '%s'.\n", optarg);
+				usage();
+			}
+			break;
+
+		case 'S':
+			/*
+			 * Keep a snapshot of the tree in this file,
+			 * and on the next run, don't read directories
+			 * which haven't changed since.
+			 */
+			snap_file = optarg;
+			break;
+
+		case 's':
+			/*
+			 * Print some statistics at the end.
+			 */
+			show_stats = 1;
+			break;
+
 		case 'v':
 			/*
 			 * Be chatty.
@@ -122,6 +452,55 @@ main(int argc, char *argv[])
 			verbose = 1;
 			break;
 
+		case 'w':
+			/*
+			 * Hash with this many worker threads, while
+			 * we get on with deciding what else needs
+			 * hashing. That needs the groups up front,
+			 * so this implies -c.
+			 */
+			if ((hash_workers = atoi(optarg)) < 0 || hash_workers > HASH_POOL_MAX) {
+				fprintf(stderr, "dupscan: -w must be from 0 to %d.\n", HASH_POOL_MAX);
+				exit(1);
+			}
+			if (hash_workers > 0)
+				collect = 1;
+			break;
+
+		case OPT_VERIFY:
+			/*
+			 * Don't take the hash's word for it. Compare
+			 * the two files byte for byte before we call
+			 * them duplicates.
+			 */
+			verify = 1;
+			break;
+
+		case OPT_MAX_READ:
+		case OPT_MAX_OPS:
+			/*
+			 * Don't read more than so many bytes, or do
+			 * more than so many opens, stats and directory
+			 * reads, a second.
+			 */
+			if ((limit = size_arg(optarg)) < 0) {
+				fprintf(stderr, "dupscan: bad rate '%s'.\n", optarg);
+				exit(1);
+			}
+			rate_set(i == OPT_MAX_READ ? RATE_READ : RATE_OPS, limit);
+			limited = 1;
+			break;
+
+		case OPT_LIMITS:
+			/*
+			 * Take the limits from a file, and read it
+			 * again on a SIGHUP.
+			 */
+			if (rate_file(optarg) < 0)
+				exit(1);
+			limited = 1;
+			break;
+
 		default:
 			usage();
 			break;
@@ -129,33 +508,134 @@ main(int argc, char *argv[])
 	}
 	if ((argc - optind) != 1)
 		usage();
-	for (i = 0; i < HASH_SIZE; i++)
-		entry_list[i] = NULL;
-	scan_dups(argv[optind]);
+	if (link_dups && dedupe) {
+		fprintf(stderr, "dupscan: -L and -D don't go together.\n");
+		exit(1);
+	}
+	if (limited)
+		rate_idle();
+	if (snap_file != NULL && nthreads > 1) {
+		fprintf(stderr, "dupscan: -S doesn't work with -j.\n");
+		exit(1);
+	}
+	if (read_backend == HASH_POOL_URING && hash_workers == 0) {
+		hash_workers = 1;
+		collect = 1;
+	}
+	if (physical && hash_workers > 0) {
+		fprintf(stderr, "dupscan: -P doesn't work with -w or -R uring.\n");
+		exit(1);
+	}
+	if (snap_file != NULL && cache_file == NULL) {
+		/*
+		 * The snapshot saves reading directories, but it's the
+		 * digests that save reading files, so -S always has a
+		 * hash cache - its own, next to it, if not given one.
+		 */
+		if ((cache_file = (char *)malloc(strlen(snap_file) + 9)) == NULL) {
+			perror("dupscan malloc");
+			exit(1);
+		}
+		sprintf(cache_file, "%s.digests", snap_file);
+	}
+	if (cache_file != NULL)
+		hcache_open(cache_file);
+	if (snap_file != NULL)
+		snap_open(snap_file);
+	sidx_init(&size_index, 0);
+	inoset_init(&inodes);
+	slab_init(&entries, sizeof(struct entry));
+	slab_init(&infos, sizeof(struct hashinfo));
+	slab_alloc(&infos);
+	if (nthreads > 1)
+		walk_tree(argv[optind], nthreads, verbose, collect_file, &scan);
+	else {
+		scan.elapsed = now();
+		scan_dups(AT_FDCWD, argv[optind], path_dir(0, NULL, argv[optind]));
+		scan.elapsed = now() - scan.elapsed;
+		snap_close();
+	}
+	if (collect)
+		group_records();
+	if (link_dups) {
+		replace_run(REPLACE_LINK, hash_workers > 0 ? hash_workers : nthreads, no_effect, verbose, &replaced);
+		printf("%s %ld duplicate%s with hard links, %llu bytes reclaimed",
+				no_effect ? "Would replace" : "Replaced", replaced.files,
+				replaced.files == 1 ? "" : "s", (unsigned long long)replaced.reclaimed);
+		if (replaced.bytes > replaced.reclaimed)
+			printf(" (%llu more still linked elsewhere)",
+					(unsigned long long)(replaced.bytes - replaced.reclaimed));
+		printf(".\n");
+		if (replaced.failed > 0)
+			printf("Failed to replace %ld duplicate%s.\n", replaced.failed,
+					replaced.failed == 1 ? "" : "s");
+	}
+	if (dedupe) {
+		replace_run(REPLACE_DEDUPE, hash_workers > 0 ? hash_workers : nthreads, no_effect, verbose, &replaced);
+		printf("%s extents of %ld duplicate%s, %llu bytes shared.\n",
+				no_effect ? "Would share" : "Shared", replaced.files,
+				replaced.files == 1 ? "" : "s", (unsigned long long)replaced.reclaimed);
+		if (replaced.differ > 0)
+			printf("Kernel found %ld duplicate%s different.\n", replaced.differ,
+					replaced.differ == 1 ? "" : "s");
+		if (replaced.failed > 0)
+			printf("Failed to share extents of %ld duplicate%s.\n", replaced.failed,
+					replaced.failed == 1 ? "" : "s");
+	}
+	if (cache_file != NULL)
+		hcache_close(&stats.cache);
+	if (show_stats)
+		print_stats();
 	exit(0);
 }
 
 /*
  * Scan a directory recursively, and build a tree of unique entries.
+ * The directory is opened relative to its parent (dfd), and everything
+ * in it is looked up relative to it in turn, so the kernel isn't
+ * resolving the full path over and over. We never need the full path
+ * here, other than for messages.
+ *
+ * The whole listing is read before anything in it is processed, onto
+ * the end of the snapshot's listing arrays. With -S, a directory which
+ * hasn't changed since the last snapshot gets its listing from there
+ * instead, and isn't read at all.
  */
 void
-scan_dups(char *path)
+scan_dups(int dfd, char *name, struct dirnode *dir)
 {
-	DIR *dirp;
-	struct dirent *dp;
+	int type;
+	size_t i, first, last;
+	char *cp, buf[PATH_MAX];
+	struct stat dst;
+	struct dirscan ds;
 
 	if (verbose)
-		printf("Directory: %s\n", path);
-	if ((dirp = opendir(path)) == NULL) {
-		perror(path);
+		printf("Directory: %s\n", path_build(dir, NULL, buf));
+	if (dir_open(&ds, dfd, name, dir->parent == NULL) < 0) {
+		perror(path_build(dir, NULL, buf));
 		exit(1);
 	}
-	while ((dp = readdir(dirp)) != NULL) {
-		if (*dp->d_name == '.' && (dp->d_name[1] == '\0' || strcmp(dp->d_name, "..") == 0))
-			continue;
-		process(path, dp->d_name);
+	first = snap_mark();
+	dst.st_dev = 0;
+	if (snap_file != NULL && fstat(ds.fd, &dst) < 0) {
+		perror(path_build(dir, NULL, buf));
+		exit(1);
+	}
+	if (snap_file != NULL && snap_replay(&dst))
+		stats.snap_dirs++;
+	else {
+		scan.dirs++;
+		while (dir_next(&ds, &cp, &type) > 0)
+			snap_entry(cp, type);
 	}
-	closedir(dirp);
+	last = snap_mark();
+	for (i = first; i < last; i++) {
+		scan.entries++;
+		process(ds.fd, dir, i, dst.st_dev);
+	}
+	snap_dir(&dst, first, last);
+	dir_close(&ds);
 }
 
 /*
@@ -165,58 +645,94 @@ scan_dups(char *path)
  * hash (generating it if needed.
  */
 void
-process(char *path, char *name)
+process(int dfd, struct dirnode *dir, size_t i, dev_t dev)
 {
-	char *cp;
-	struct entry *ep;
+	int type, stale = 0;
+	uint32_t e, p;
+	int64_t mtime = 0, ctime = 0;
 	struct stat stbuf;
+	struct snap_ent *sp;
+	char name[NAME_MAX + 1], buf[PATH_MAX];
 
 	/*
-	 * Allocate space for the fully-qualified path.
+	 * Only regular files need a stat. The directory entry already
+	 * says what everything else is, unless the filesystem doesn't
+	 * keep the type. What the stat says goes back in the listing,
+	 * so a listing from the snapshot doesn't need one at all. The
+	 * name is copied, as the listing moves when it grows.
 	 */
-	if ((cp = (char *)malloc(strlen(path) + strlen(name) + 2)) == NULL) {
-		perror("process malloc");
-		exit(1);
-	}
-	strcpy(cp, path);
-	strcat(cp, "/");
-	strcat(cp, name);
-	if (lstat(cp, &stbuf) < 0) {
-		perror("process lstat");
-		exit(1);
+	sp = snap_get(i);
+	strcpy(name, snap_name(i));
+	type = sp->type;
+	if ((sp->flags & SNAP_STAT) != 0) {
+		stbuf.st_size = sp->size;
+		stbuf.st_ino = sp->inode;
+		stbuf.st_nlink = sp->nlink;
+		stbuf.st_dev = dev;
+		mtime = sp->mtime;
+		ctime = sp->ctime;
+		stale = 1;
+	} else if (type == DT_REG || type == DT_UNKNOWN) {
+		scan.stats++;
+		rate_take(RATE_OPS, 1);
+		if (fstatat(dfd, name, &stbuf, AT_SYMLINK_NOFOLLOW) < 0) {
+			fprintf(stderr, "%s: ", path_build(dir, name, buf));
+			perror("process fstatat");
+			exit(1);
+		}
+		type = IFTODT(stbuf.st_mode);
+		sp->type = type;
+		sp->size = stbuf.st_size;
+		sp->inode = stbuf.st_ino;
+		sp->nlink = stbuf.st_nlink;
+		sp->mtime = mtime = ST_MTIME(&stbuf);
+		sp->ctime = ctime = ST_CTIME(&stbuf);
+		sp->flags |= SNAP_STAT;
 	}
-	switch (stbuf.st_mode & S_IFMT) {
-	case S_IFREG:
+	switch (type) {
+	case DT_REG:
 		/*
-		 * A regular file - ignore zero-length files. I
-		 * don't care about them. For everything else, store
-		 * what we've gleaned and call the regular file
-		 * function to see if there's a duplicate.
+		 * A regular file (and not an empty one - I don't
+		 * care about them). Store what we've gleaned and
+		 * call the regular file function to see if there's
+		 * a duplicate. All we keep of the path is the name,
+		 * and the node for the directory it's in. Another
+		 * link to a file we've already seen goes no further.
 		 */
-		if (stbuf.st_size > 0L) {
-			ep = entry_alloc(cp);
-			ep->size = stbuf.st_size;
-			ep->nlinks = stbuf.st_nlink;
-			ep->device = stbuf.st_dev;
-			ep->inode = stbuf.st_ino;
-			regular_file(ep);
+		if (stbuf.st_size == 0L)
+			break;
+		if (collect) {
+			col_add(&colbufs[0], stbuf.st_size, stbuf.st_dev, stbuf.st_ino, stbuf.st_nlink,
+					mtime, ctime, stale ? COL_STALE : 0, dir, path_name(0, name));
+			break;
 		}
+		stats.files++;
+		p = path_add(dir, path_name(0, name));
+		if (hard_link(p, stbuf.st_dev, stbuf.st_ino, stbuf.st_nlink))
+			break;
+		e = entry_alloc(p, stbuf.st_size, stbuf.st_dev, stbuf.st_ino);
+		ENT(e)->nlinks = stbuf.st_nlink;
+		ENT(e)->mtime = mtime;
+		ENT(e)->ctime = ctime;
+		if (stale)
+			ENT(e)->flags |= E_STALE;
+		regular_file(e);
 		break;
 
-	case S_IFDIR:
+	case DT_DIR:
 		/*
 		 * A directory - magic recursion!
 		 */
-		scan_dups(cp);
+		scan_dups(dfd, name, path_dir(0, dir, name));
 		break;
 
-	case S_IFLNK:
+	case DT_LNK:
 		/*
 		 * Not sure what to do about symlinks, but for the
 		 * most part, they're inert, so I'm ignoring them.
 		 */
 		if (verbose)
-			printf("Ignoring a symlink (%s).\n", cp);
+			printf("Ignoring a symlink (%s).\n", path_build(dir, name, buf));
 		break;
 
 	default:
@@ -227,7 +743,7 @@ process(char *path, char *name)
 		 * something. Either way, stop now before we do
 		 * real damage.
 		 */
-		fprintf(stderr, "Can't handle file type for %s.\n", cp);
+		fprintf(stderr, "Can't handle file type for %s.\n", path_build(dir, name, buf));
 		exit(1);
 	}
 }
@@ -236,7 +752,11 @@ process(char *path, char *name)
  * We have a regular file - is it a duplicate?
  *
  * Where a duplicate file is found, perform some sort of action.
- * This would normally be to create a symlink back to the original.
+ * With -L, it's queued up to be replaced with a hard link to the
+ * original once the scan is over (see replace.c), and with -D, to have
+ * its extents shared with the original's. Either can only be done if
+ * the two are on the same device.
+ *
  * A nicer optimization might be to just record the duplicate, and
  * then mark the actual directory as a duplicate if all the files
  * in the directory are duplicates. Then, just remove all the files
@@ -245,143 +765,972 @@ process(char *path, char *name)
  * "gotcha" with that approach is cross-links in two dirs.
  */
 void
-regular_file(struct entry *ep)
+regular_file(uint32_t e)
 {
-	struct entry *dup_ep;
+	struct entry *ep = ENT(e), *dup_ep;
 
 	if (verbose)
-		printf("Regular file: %s, size: %ld.\n", ep->path, ep->size);
-	if ((dup_ep = find_entry(ep)) != NULL) {
-		printf(">>> DUP file: %s. ", ep->path);
-		printf("Original: %s.\n", dup_ep->path);
-		entry_free(ep);
+		printf("Regular file: %s, size: %ld.\n", ep_path(ep), (long)ep->size);
+	if ((dup_ep = find_entry(e)) != NULL)
+		duplicate(e, dup_ep);
+}
+
+/*
+ * Entry "e" is a duplicate of "dup_ep". Report it, queue it up for -L
+ * or -D, and let it go.
+ */
+void
+duplicate(uint32_t e, struct entry *dup_ep)
+{
+	struct entry *ep = ENT(e);
+	struct replace_file dfile, ofile;
+
+	stats.dups++;
+	printf(">>> DUP file: %s. ", ep_path(ep));
+	printf("Original: %s.\n", ep_path(dup_ep));
+	if (link_dups || dedupe) {
+		if (ep->device == dup_ep->device) {
+			entry_file(ep, &dfile);
+			entry_file(dup_ep, &ofile);
+			replace_add(&paths[ep->path], &dfile, &paths[dup_ep->path], &ofile, ep->nlinks);
+		} else
+			fprintf(stderr, "Can't share %s with %s: different devices.\n",
+					ep_path(ep), ep_path(dup_ep));
+	}
+	entry_free(e);
+}
+
+/*
+ * Record a regular file for later (-c). All we keep is what we need
+ * to group it, in a columnar store (columns.c), and the grouping is done
+ * once the scan is over. This is called from scan thread "tid", which
+ * is the only one to touch that store. Empty files are of no interest.
+ */
+void
+collect_file(int tid, struct dirnode *dir, const char *name, struct stat *sp)
+{
+	if (sp->st_size == 0)
+		return;
+	col_add(&colbufs[tid], sp->st_size, sp->st_dev, sp->st_ino, sp->st_nlink,
+			ST_MTIME(sp), ST_CTIME(sp), 0, dir, path_name(tid, name));
+}
+
+/*
+ * The scan is done (-c). Sort the files by size, and then run each
+ * group of two or more same-size files through the usual duplicate
+ * check. A file with a size all of its own is never opened. Neither is
+ * a second hard link to a file we already have (see hard_link()). With
+ * the store sorted, finding the groups is a straight run along the size
+ * column, and the other columns are only looked at for files in a
+ * group. Once that's done, only the paths column is kept, as paths[],
+ * since the entries point into it.
+ */
+void
+group_records()
+{
+	size_t i, j, k, n, max_ents, nents;
+	uint32_t r, *ents;
+	struct columns files;
+
+	if (hash_workers > 0)
+		hash_pool_start(hash_workers, queue_depth, read_backend);
+	col_merge(&files, colbufs, WALK_MAX_THREADS);
+	col_sort(&files);
+	stats.files += files.n;
+	paths = files.paths;
+	npaths = max_paths = files.n;
+	for (max_ents = 0, ents = NULL, i = 0; i < files.n; i = j) {
+		j = col_next_run(&files, i);
+		stats.unique_size += j - i;
+		if (j == files.n)
+			break;
+		i = j;
+		j = col_run_end(&files, i);
+		n = j - i;
+		stats.groups++;
+		if (n > max_ents) {
+			max_ents = n;
+			if ((ents = (uint32_t *)realloc(ents, max_ents * sizeof(*ents))) == NULL) {
+				perror("group_records realloc");
+				exit(1);
+			}
+		}
+		for (nents = 0, k = i; k < j; k++) {
+			r = files.row[k];
+			if (hard_link(r, files.device[r], files.inode[r], files.nlink[r]))
+				continue;
+			ents[nents] = entry_alloc(r, files.size[k], files.device[r], files.inode[r]);
+			ENT(ents[nents])->mtime = files.mtime[r];
+			ENT(ents[nents])->ctime = files.ctime[r];
+			if ((files.flags[r] & COL_STALE) != 0)
+				ENT(ents[nents])->flags |= E_STALE;
+			ENT(ents[nents++])->nlinks = files.nlink[r];
+		}
+		if (hash_workers > 0)
+			pipe_group(ents, nents);
+		else if (physical)
+			physical_add(ents, nents);
+		else if (nents <= HASH_MB_FILES && cache_file == NULL)
+			compare_entries(ents, nents);
+		else
+			for (k = 0; k < nents; k++)
+				regular_file(ents[k]);
+	}
+	if (hash_workers > 0) {
+		pipe_resolve(1);
+		hash_pool_stop(&pool);
+	}
+	if (physical)
+		physical_run();
+	free((void *)ents);
+	files.paths = NULL;
+	col_free(&files);
+}
+
+/*
+ * Send a same-size group to the hash pool (-w). Only the entries which
+ * survive the prefilter against at least one of the others are hashed,
+ * which is exactly the set that find_entry() would have hashed. When
+ * all the digests are back, the group goes through the usual checks,
+ * which find the digests already there.
+ */
+void
+pipe_group(uint32_t *ents, int n)
+{
+	int i, spins;
+	double t0;
+	struct pgroup *gp;
+
+	if ((gp = (struct pgroup *)malloc(sizeof(*gp) + n * (sizeof(struct hash_req) +
+			sizeof(struct hcache_key) + sizeof(uint32_t)))) == NULL) {
+		perror("pipe_group malloc");
+		exit(1);
+	}
+	gp->next = NULL;
+	gp->n = n;
+	gp->pending = 0;
+	gp->keys = (struct hcache_key *)&gp->reqs[n];
+	gp->ents = (uint32_t *)&gp->keys[n];
+	for (i = 0; i < n; i++) {
+		gp->ents[i] = ents[i];
+		gp->reqs[i].path = NULL;
+		gp->reqs[i].digest = NULL;
+		gp->reqs[i].error = 0;
+		gp->reqs[i].arg = gp;
+	}
+	for (i = 0; i < n; i++) {
+		if (pipe_need_hash(ents, n, i)) {
+			if ((gp->reqs[i].path = strdup(ep_path(ENT(ents[i])))) == NULL) {
+				perror("pipe_group strdup");
+				exit(1);
+			}
+			if (cache_file != NULL && entry_key(ENT(ents[i]), &gp->keys[i]) < 0)
+				memset(&gp->keys[i], 0, sizeof(gp->keys[i]));
+			gp->reqs[i].digest = entry_info(ENT(ents[i]))->digest;
+			gp->pending++;
+		}
+	}
+	if (pipe_tail == NULL)
+		pipe_head = gp;
+	else
+		pipe_tail->next = gp;
+	pipe_tail = gp;
+	for (i = 0; i < n; i++) {
+		if (gp->reqs[i].path == NULL || hash_pool_submit(&gp->reqs[i]))
+			continue;
+		t0 = now();
+		for (spins = 0; !hash_pool_submit(&gp->reqs[i]); spins++) {
+			pipe_resolve(0);
+			hash_pause(spins);
+		}
+		stats.stall_submit += now() - t0;
+	}
+	pipe_resolve(0);
+}
+
+/*
+ * A same-size group which is small enough (-c) doesn't get hashed at
+ * all. The files are compared against each other a chunk at a time,
+ * which stops as soon as they're all known to be different, and each
+ * one which turns out to be the same as an earlier one is reported
+ * against it. That's the same original regular_file() would have
+ * picked. Anything the samples say can't match is left out. Digests
+ * are only worth having for bigger groups, or to keep for next time
+ * (-C).
+ */
+void
+compare_entries(uint32_t *ents, int n)
+{
+	int i, k, cls[HASH_MB_FILES], errs[HASH_MB_FILES], idx[HASH_MB_FILES];
+	const char *names[HASH_MB_FILES];
+	char bufs[HASH_MB_FILES][PATH_MAX];
+	struct entry *ep;
+
+	for (k = i = 0; i < n; i++) {
+		if (!pipe_need_hash(ents, n, i))
+			continue;
+		ep = ENT(ents[i]);
+		names[k] = path_build(PATH_DIR(ep), PATH_NAME(ep), bufs[k]);
+		idx[k++] = i;
+	}
+	if (k > 1) {
+		compare_group(names, k, cls, errs);
+		stats.compared += k;
+		for (i = 0; i < k; i++) {
+			if (errs[i] != 0) {
+				fprintf(stderr, "Can't compare %s: %s\n", names[i], strerror(errs[i]));
+				exit(1);
+			}
+			if (cls[i] != i)
+				duplicate(ents[idx[i]], ENT(ents[idx[cls[i]]]));
+		}
+	}
+}
+
+/*
+ * Hold on to a same-size group until everything's been found (-P).
+ */
+void
+physical_add(uint32_t *ents, int n)
+{
+	if (n < 2)
+		return;
+	if (npents + n > max_pents) {
+		while (npents + n > max_pents)
+			max_pents = max_pents == 0 ? 4096 : max_pents * 2;
+		if ((pents = (uint32_t *)realloc(pents, max_pents * sizeof(*pents))) == NULL) {
+			perror("physical_add realloc");
+			exit(1);
+		}
+	}
+	if (npends == max_pends) {
+		max_pends = max_pends == 0 ? 1024 : max_pends * 2;
+		if ((pends = (size_t *)realloc(pends, max_pends * sizeof(*pends))) == NULL) {
+			perror("physical_add realloc");
+			exit(1);
+		}
+	}
+	memcpy(pents + npents, ents, n * sizeof(*ents));
+	npents += n;
+	pends[npends++] = npents;
+}
+
+/*
+ * Read every file that needs it in the order its data starts on the
+ * disk (-P), by device and then physical offset from FIEMAP. The head
+ * and tail samples come first, in that order, then the full digests of
+ * the files the samples couldn't rule out, in that order again. Only
+ * then are the groups gone through as usual, which finds everything it
+ * wants already done. A file with no extent to go by goes last.
+ */
+void
+physical_run()
+{
+	size_t i, g, first;
+	char *need;
+	struct entry *ep;
+	struct porder *order;
+
+	if (npents == 0)
+		return;
+	if ((order = (struct porder *)malloc(npents * sizeof(*order))) == NULL ||
+			(need = (char *)malloc(npents)) == NULL) {
+		perror("physical_run malloc");
+		exit(1);
+	}
+	for (i = 0; i < npents; i++) {
+		ep = ENT(pents[i]);
+		order[i].device = ep->device;
+		order[i].ent = pents[i];
+		order[i].pos = i;
+		if (extent_first(ep_path(ep), &order[i].phys) < 0) {
+			fprintf(stderr, "%s: ", ep_path(ep));
+			perror("physical_run open");
+			exit(1);
+		}
+		if (order[i].phys == EXTENT_NONE)
+			stats.no_extent++;
+	}
+	qsort(order, npents, sizeof(*order), porder_cmp);
+	for (i = 0; i < npents; i++) {
+		ep = ENT(order[i].ent);
+		if (ep->size > PREFILTER_MIN && !cache_check(ep))
+			sample_hash(ep, E_QUICK);
+	}
+	for (first = g = 0; g < npends; first = pends[g++])
+		for (i = first; i < pends[g]; i++)
+			need[i] = pipe_need_hash(pents + first, pends[g] - first, i - first);
+	for (i = 0; i < npents; i++)
+		if (need[order[i].pos])
+			generate_hash(ENT(order[i].ent));
+	for (i = 0; i < npents; i++)
+		regular_file(pents[i]);
+	free((void *)order);
+	free((void *)need);
+	free((void *)pents);
+	free((void *)pends);
+	pents = NULL;
+	pends = NULL;
+	npents = max_pents = npends = max_pends = 0;
+}
+
+/*
+ * Physical order: by device, then offset, then as they were found.
+ */
+int
+porder_cmp(const void *p1, const void *p2)
+{
+	const struct porder *op1 = (const struct porder *)p1, *op2 = (const struct porder *)p2;
+
+	if (op1->device != op2->device)
+		return(op1->device < op2->device ? -1 : 1);
+	if (op1->phys != op2->phys)
+		return(op1->phys < op2->phys ? -1 : 1);
+	return(op1->pos < op2->pos ? -1 : op1->pos > op2->pos);
+}
+
+/*
+ * Does entry "i" of a group need hashing? Only if one of the others
+ * has the same sample hashes, and the hash cache doesn't have it.
+ */
+int
+pipe_need_hash(uint32_t *ents, int n, int i)
+{
+	int j;
+	struct entry *ep1, *ep2;
+
+	if (n < 2 || cache_check(ENT(ents[i])))
+		return(0);
+	if ((ep1 = ENT(ents[i]))->size <= PREFILTER_MIN)
+		return(1);
+	for (j = 0; j < n; j++) {
+		if (j == i)
+			continue;
+		ep2 = ENT(ents[j]);
+		sample_hash(ep1, E_QUICK);
+		sample_hash(ep2, E_QUICK);
+		if (entry_info(ep1)->quick != entry_info(ep2)->quick)
+			continue;
+		if (!sample_middle)
+			return(1);
+		sample_hash(ep1, E_MIDDLE);
+		sample_hash(ep2, E_MIDDLE);
+		if (entry_info(ep1)->middle == entry_info(ep2)->middle)
+			return(1);
+	}
+	return(0);
+}
+
+/*
+ * A digest has come back from the pool.
+ */
+void
+pipe_done(struct hash_req *rp)
+{
+	struct pgroup *gp = (struct pgroup *)rp->arg;
+
+	if (rp->error != 0) {
+		fprintf(stderr, "Some sort of hash failure?!? Do you have permission to access the file?\n");
+		fprintf(stderr, "File: %s\n", rp->path);
+		fprintf(stderr, "System reports: %s\n", strerror(rp->error));
+		exit(1);
+	}
+	ENT(gp->ents[rp - gp->reqs])->flags |= E_HASHED;
+	if (cache_file != NULL && gp->keys[rp - gp->reqs].size != 0)
+		hcache_add(&gp->keys[rp - gp->reqs], rp->digest);
+	free((void *)rp->path);
+	rp->path = NULL;
+	stats.hashed++;
+	gp->pending--;
+}
+
+/*
+ * Collect whatever digests are back, and resolve the groups at the head
+ * of the pipeline which are complete. If "wait" is set, keep going until
+ * every group is done.
+ */
+void
+pipe_resolve(int wait)
+{
+	int i, spins;
+	double t0;
+	struct pgroup *gp;
+	struct hash_req *rp;
+
+	for (;;) {
+		while ((rp = hash_pool_reap()) != NULL)
+			pipe_done(rp);
+		if ((gp = pipe_head) == NULL)
+			break;
+		if (gp->pending > 0) {
+			if (!wait)
+				break;
+			t0 = now();
+			for (spins = 0; gp->pending > 0; spins++) {
+				if ((rp = hash_pool_reap()) != NULL) {
+					pipe_done(rp);
+					spins = 0;
+				} else
+					hash_pause(spins);
+			}
+			stats.stall_digest += now() - t0;
+		}
+		if ((pipe_head = gp->next) == NULL)
+			pipe_tail = NULL;
+		for (i = 0; i < gp->n; i++)
+			regular_file(gp->ents[i]);
+		free((void *)gp);
 	}
 }
 
 /*
  * Find an existing entry, based on the current (passed-in) entry. Returns
  * the original entry if one already exists.
+ *
+ * Same-size entries go through the cheap prefilter stages first, and
+ * only the ones which survive are hashed in full.
  */
 struct entry *
-find_entry(struct entry *orig_ep)
+find_entry(uint32_t orig)
 {
-	int hash;
-	struct entry *ep, *last_ep;
+	int i, n;
+	void **vp;
+	struct entry *ep, *orig_ep = ENT(orig);
+	struct group *gp;
+	static int ncand_max = 0;
+	static struct entry **cand = NULL;
 
-	hash = orig_ep->size % HASH_SIZE;
 	if (verbose)
-		printf("Search for file: %s (size:%ld,hash%d).\n", orig_ep->path, orig_ep->size, hash);
-	if (entry_list[hash] == NULL || entry_list[hash]->size > orig_ep->size) {
-		orig_ep->next = entry_list[hash];
-		entry_list[hash] = orig_ep;
+		printf("Search for file: %s (size:%ld).\n", ep_path(orig_ep), (long)orig_ep->size);
+	vp = sidx_insert(&size_index, orig_ep->size);
+	if ((gp = (struct group *)*vp) == NULL) {
+		if (!collect)
+			stats.unique_size++;
+		*vp = group_add(NULL, orig);
 		return(NULL);
 	}
-	for (last_ep = NULL, ep = entry_list[hash]; ep != NULL && ep->size <= orig_ep->size; ep = ep->next) {
-		if (ep->size == orig_ep->size) {
-			/*
-			 * Size match!
-			 */
+	for (n = i = 0; i < gp->n; i++) {
+		/*
+		 * Size match!
+		 */
+		ep = ENT(gp->ent[i]);
+		if (verbose)
+			printf("Matches (size) for %s.\n", ep_path(ep));
+		if (!prefilter(orig_ep, ep))
+			continue;
+		if (n + 1 >= ncand_max) {
+			ncand_max = ncand_max == 0 ? 64 : ncand_max * 2;
+			if ((cand = (struct entry **)realloc(cand, ncand_max * sizeof(*cand))) == NULL) {
+				perror("find_entry realloc");
+				exit(1);
+			}
+		}
+		cand[n++] = ep;
+	}
+	if (n > 0) {
+		/*
+		 * We do a "lazy-load" of the hash entry.
+		 * In other words, only hash the file(s)
+		 * if there is a size match. In a perfect
+		 * world, all the files would have different
+		 * sizes, and we'd have no need to compute
+		 * a hash. So, in the optimistic hope that
+		 * this is the case, we delay the hash
+		 * computation until we need it. When we
+		 * do, hash every candidate that still
+		 * needs it in one go, so they can share a
+		 * multi-buffer pass.
+		 */
+		cand[n] = orig_ep;
+		generate_hash_batch(cand, n + 1);
+		for (i = 0; i < n; i++) {
+			if (!digest_equal(entry_info(cand[i])->digest, entry_info(orig_ep)->digest)) {
+				stats.rej_hash++;
+				continue;
+			}
 			if (verbose)
-				printf("Matches (size) for %s.\n", ep->path);
-			/*
-			 * We do a "lazy-load" of the hash entry.
-			 * In other words, only hash the file(s)
-			 * if there is a size match. In a perfect
-			 * world, all the files would have different
-			 * sizes, and we'd have no need to compute
-			 * a hash. So, in the optimistic hope that
-			 * this is the case, we delay the hash
-			 * computation until we need it.
-			 */
-			if (orig_ep->hash == NULL)
-				generate_hash(orig_ep);
-			if (ep->hash == NULL)
-				generate_hash(ep);
-			if (strcmp(ep->hash, orig_ep->hash) == 0) {
-				if (verbose)
-					printf("Matches (hash).\n");
-				return(ep);
+				printf("Matches (hash).\n");
+			if (verify && !verify_entries(cand[i], orig_ep)) {
+				stats.rej_verify++;
+				continue;
 			}
+			return(cand[i]);
 		}
-		last_ep = ep;
 	}
 	/*
-	 * No match for the file. Need to add it in the current position.
+	 * No match for the file. Add it to the group for this size.
 	 */
-	orig_ep->next = last_ep->next;
-	last_ep->next = orig_ep;
+	*vp = group_add(gp, orig);
 	return(NULL);
 }
 
 /*
- * Generate a cryptographically secure (no collisions) hash of the file.
+ * Add an entry to a size group (creating the group if need be), and
+ * return the group. It might have moved.
+ */
+struct group *
+group_add(struct group *gp, uint32_t e)
+{
+	int n, max;
+
+	n = gp == NULL ? 0 : gp->n;
+	if (gp == NULL || gp->n == gp->max) {
+		max = gp == NULL ? 2 : gp->max * 2;
+		if ((gp = (struct group *)realloc(gp, sizeof(*gp) + max * sizeof(gp->ent[0]))) == NULL) {
+			perror("group_add realloc");
+			exit(1);
+		}
+		gp->n = n;
+		gp->max = max;
+	}
+	gp->ent[gp->n++] = e;
+	return(gp);
+}
+
+/*
+ * Run the cheap stages of the comparison on two entries of the same
+ * size. First a hash of the head and tail of each file, then (with -m)
+ * a block from the middle. The sample hashes are kept on the entry, so
+ * each file is only sampled once. If the hash cache already has both
+ * digests, there's no point sampling either of them. Returns non-zero
+ * if the two might still be the same, and it's worth hashing them in
+ * full.
+ */
+int
+prefilter(struct entry *ep1, struct entry *ep2)
+{
+	int c1, c2;
+
+	if (ep1->size <= PREFILTER_MIN)
+		return(1);
+	c1 = cache_check(ep1);
+	c2 = cache_check(ep2);
+	if (c1 && c2)
+		return(1);
+	sample_hash(ep1, E_QUICK);
+	sample_hash(ep2, E_QUICK);
+	if (entry_info(ep1)->quick != entry_info(ep2)->quick) {
+		stats.rej_quick++;
+		return(0);
+	}
+	if (!sample_middle)
+		return(1);
+	sample_hash(ep1, E_MIDDLE);
+	sample_hash(ep2, E_MIDDLE);
+	if (entry_info(ep1)->middle != entry_info(ep2)->middle) {
+		stats.rej_middle++;
+		return(0);
+	}
+	return(1);
+}
+
+/*
+ * Compute one of the sample hashes for an entry, if we don't already
+ * have it.
+ */
+void
+sample_hash(struct entry *ep, int which)
+{
+	off_t off[2];
+	struct hashinfo *hp;
+
+	if (ep->flags & which)
+		return;
+	hp = entry_info(ep);
+	if (which == E_QUICK) {
+		off[0] = 0;
+		off[1] = ep->size - PREFILTER_BLOCK;
+		if (hash_sample(ep_path(ep), off, 2, PREFILTER_BLOCK, &hp->quick) < 0)
+			goto fail;
+	} else {
+		off[0] = (ep->size / 2) & ~(off_t)(PREFILTER_BLOCK - 1);
+		if (hash_sample(ep_path(ep), off, 1, PREFILTER_BLOCK, &hp->middle) < 0)
+			goto fail;
+	}
+	ep->flags |= which;
+	return;
+fail:
+	fprintf(stderr, "Some sort of hash failure?!? Do you have permission to access the file?\n");
+	fprintf(stderr, "File: %s\n", ep_path(ep));
+	perror("System reports");
+	exit(1);
+}
+
+/*
+ * Generate a hash of the file. This used to run sha256sum through
+ * popen(), which meant a fork and exec for every file. Now we read the
+ * file ourselves, and keep the binary digest with the entry. By default
+ * that's a cryptographically secure (no collisions) SHA-256, but -a
+ * can swap in something quicker. With -C, the hash cache is tried
+ * first, and gets the new digest. The cache key is taken before the
+ * file is read, so if it changes while we're reading it, the digest
+ * won't be trusted next time.
  */
 void
 generate_hash(struct entry *ep)
 {
-	int cmdlen;
-	char *cp, *cmd;
-	FILE *pp;
+	struct hcache_key key;
 
-	cmdlen = strlen(HASH_COMMAND) + strlen(ep->path) + 100;
-	if ((cmd = (char *)malloc(cmdlen)) == NULL) {
-		perror("generate_hash malloc");
+	if (cache_check(ep))
+		return;
+	if (cache_file != NULL && entry_key(ep, &key) < 0)
+		key.size = 0;
+	if (hash_file(ep_path(ep), entry_info(ep)->digest) < 0) {
+		fprintf(stderr, "Some sort of hash failure?!? Do you have permission to access the file?\n");
+		fprintf(stderr, "File: %s\n", ep_path(ep));
+		perror("System reports");
 		exit(1);
 	}
-	sprintf(cmd, "%s \"%s\"", HASH_COMMAND, ep->path);
-	if ((pp = popen(cmd, "r")) == NULL) {
-		fprintf(stderr, "generate_hash: ");
-		perror(cmd);
-		exit(1);
+	ep->flags |= E_HASHED;
+	stats.hashed++;
+	if (cache_file != NULL && key.size != 0)
+		hcache_add(&key, entry_info(ep)->digest);
+}
+
+/*
+ * Hash a batch of same-size files together. Much the same as calling
+ * generate_hash() on each of them, only quicker. Entries which already
+ * have a hash (or can get it from the cache) are skipped.
+ */
+void
+generate_hash_batch(struct entry **eps, int n)
+{
+	int i, k, errs[HASH_MB_FILES];
+	const char *names[HASH_MB_FILES];
+	char bufs[HASH_MB_FILES][PATH_MAX];
+	struct entry *batch[HASH_MB_FILES];
+	struct hcache_key keys[HASH_MB_FILES];
+	unsigned char digests[HASH_MB_FILES][HASH_MAX_DIGEST];
+
+	while (n > 0) {
+		for (k = 0; n > 0 && k < HASH_MB_FILES; eps++, n--) {
+			if (cache_check(*eps))
+				continue;
+			batch[k] = *eps;
+			names[k] = path_build(PATH_DIR(*eps), PATH_NAME(*eps), bufs[k]);
+			if (cache_file != NULL && entry_key(*eps, &keys[k]) < 0)
+				keys[k].size = 0;
+			k++;
+		}
+		if (k == 1) {
+			generate_hash(batch[0]);
+			continue;
+		}
+		hash_files(names, k, digests, errs);
+		for (i = 0; i < k; i++) {
+			if (errs[i] != 0) {
+				fprintf(stderr, "Some sort of hash failure?!? Do you have permission to access the file?\n");
+				fprintf(stderr, "File: %s\n", names[i]);
+				fprintf(stderr, "System reports: %s\n", strerror(errs[i]));
+				exit(1);
+			}
+			memcpy(entry_info(batch[i])->digest, digests[i], HASH_MAX_DIGEST);
+			batch[i]->flags |= E_HASHED;
+			stats.hashed++;
+			if (cache_file != NULL && keys[i].size != 0)
+				hcache_add(&keys[i], digests[i]);
+		}
 	}
-	if ((cp = fgets(cmd, cmdlen - 1, pp)) == NULL) {
-		fprintf(stderr, "Some sort of hash failure?!? Do you have permission to access the file?\n");
-		fprintf(stderr, "File: %s\n", ep->path);
+}
+
+/*
+ * Compare two entries with matching digests byte for byte (--verify).
+ * Returns non-zero if they really are the same.
+ */
+int
+verify_entries(struct entry *ep1, struct entry *ep2)
+{
+	int same;
+
+	if ((same = compare_files(ep_path(ep1), ep_path(ep2))) < 0) {
+		fprintf(stderr, "Can't compare %s with %s.\n", ep_path(ep1), ep_path(ep2));
 		perror("System reports");
 		exit(1);
 	}
-	pclose(pp);
-	if ((cp = strchr(cmd, ' ')) != NULL)
-		*cp = '\0';
-	ep->hash = cmd;
+	if (!same)
+		fprintf(stderr, "Hash collision: %s and %s differ.\n", ep_path(ep1), ep_path(ep2));
+	return(same);
 }
 
 /*
- * Allocate a new entry and set some basics, like the full path.
+ * Try the hash cache (-C) for an entry's digest, if that hasn't been
+ * done already. Returns non-zero if the entry has its digest.
  */
-struct entry *
-entry_alloc(char *name)
+int
+cache_check(struct entry *ep)
+{
+	struct hcache_key key;
+
+	if (cache_file == NULL || (ep->flags & (E_HASHED | E_CACHED)) != 0)
+		return(ep->flags & E_HASHED);
+	ep->flags |= E_CACHED;
+	if (entry_key(ep, &key) < 0 || !hcache_lookup(&key, entry_info(ep)->digest))
+		return(0);
+	ep->flags |= E_HASHED;
+	return(1);
+}
+
+/*
+ * Allocate a new entry and set some basics, like where it is. Entries
+ * come out of the slab in the order the files were found, so a group's
+ * entries tend to be close together.
+ */
+uint32_t
+entry_alloc(uint32_t path, uint64_t size, dev_t device, ino_t inode)
 {
+	uint32_t e;
 	struct entry *ep;
 
-	if ((ep = freelist) != NULL) {
-		freelist = ep->next;
-	} else {
-		if ((ep = (struct entry *)malloc(sizeof(*ep))) == NULL) {
-			perror("entry_alloc");
+	ep = ENT(e = slab_alloc(&entries));
+	ep->size = size;
+	ep->inode = inode;
+	ep->device = device_index(device);
+	ep->nlinks = 0;
+	ep->path = path;
+	ep->info = 0;
+	ep->flags = 0;
+	return(e);
+}
+
+/*
+ * Release an entry (and its hashinfo) back to the slab. The path stays
+ * where it is.
+ */
+void
+entry_free(uint32_t e)
+{
+	struct entry *ep = ENT(e);
+
+	if (ep->info != 0)
+		slab_free(&infos, ep->info);
+	slab_free(&entries, e);
+}
+
+/*
+ * What -L and -D need to know of an entry, to tell if it has changed.
+ */
+void
+entry_file(struct entry *ep, struct replace_file *fp)
+{
+	fp->inode = ep->inode;
+	fp->size = ep->size;
+	fp->mtime = ep->mtime;
+	fp->ctime = ep->ctime;
+}
+
+/*
+ * The hash cache (-C) key for an entry. It's all in the entry already,
+ * unless that came from the snapshot (-S), which can be out of date for
+ * a file rewritten in place. Then the file is looked at once, and if
+ * it's still the same inode and size, the entry takes its times.
+ * Returns -1 if there's no key to be had.
+ */
+int
+entry_key(struct entry *ep, struct hcache_key *kp)
+{
+	if ((ep->flags & E_STALE) != 0) {
+		if (hcache_key(ep_path(ep), kp) < 0 || kp->inode != ep->inode || kp->size != ep->size)
+			return(-1);
+		ep->mtime = kp->mtime;
+		ep->ctime = kp->ctime;
+		ep->flags &= ~E_STALE;
+		return(0);
+	}
+	kp->device = devices[ep->device];
+	kp->inode = ep->inode;
+	kp->size = ep->size;
+	kp->mtime = ep->mtime;
+	kp->ctime = ep->ctime;
+	return(0);
+}
+
+/*
+ * The hashinfo for an entry, which is allocated the first time it's
+ * asked for. Index zero is never handed out, so it means "none yet".
+ */
+struct hashinfo *
+entry_info(struct entry *ep)
+{
+	if (ep->info == 0)
+		ep->info = slab_alloc(&infos);
+	return((struct hashinfo *)slab_ptr(&infos, ep->info));
+}
+
+/*
+ * Add a path to paths[], and return its index. With -c, the paths are
+ * all there already, from the scan.
+ */
+uint32_t
+path_add(struct dirnode *dir, const char *name)
+{
+	if (npaths == max_paths) {
+		max_paths = max_paths == 0 ? 4096 : max_paths * 2;
+		if ((paths = (struct pathref *)realloc(paths, max_paths * sizeof(*paths))) == NULL) {
+			perror("path_add realloc");
 			exit(1);
 		}
 	}
-	ep->next = NULL;
-	ep->path = name;
-	ep->size = 0L;
-	ep->hash = NULL;
-	return(ep);
+	paths[npaths].dir = dir;
+	paths[npaths].name = name;
+	return(npaths++);
+}
+
+/*
+ * Is this file just another link to one we've already seen? Files with
+ * more than one link go into a set, keyed on device and inode, along
+ * with the path of the first link we found. A later link to the same
+ * inode is reported as such, without opening anything. There's no
+ * point hashing it, and it isn't a duplicate - it's the same file.
+ */
+int
+hard_link(uint32_t path, dev_t device, ino_t inode, nlink_t nlinks)
+{
+	uint32_t *vp;
+	char buf[PATH_MAX];
+
+	if (nlinks < 2)
+		return(0);
+	vp = inoset_insert(&inodes, device_index(device), inode);
+	if (*vp == INOSET_EMPTY) {
+		*vp = path;
+		return(0);
+	}
+	stats.links++;
+	printf(">>> LINK file: %s. ", path_build(paths[path].dir, paths[path].name, buf));
+	printf("Original: %s.\n", path_build(paths[*vp].dir, paths[*vp].name, buf));
+	return(1);
+}
+
+/*
+ * Turn a device number into a (small) index. There are only ever a
+ * handful of devices, and mostly the same one as last time.
+ */
+uint32_t
+device_index(dev_t dev)
+{
+	int i;
+	static int last = 0;
+
+	if (last < ndevices && devices[last] == dev)
+		return(last);
+	for (i = 0; i < ndevices; i++)
+		if (devices[i] == dev)
+			return(last = i);
+	if ((devices = (dev_t *)realloc(devices, (ndevices + 1) * sizeof(dev_t))) == NULL) {
+		perror("device_index realloc");
+		exit(1);
+	}
+	devices[ndevices] = dev;
+	return(last = ndevices++);
 }
 
 /*
- * Release an entry back to the freelist.
+ * The full path of an entry. It's put together in one of a few static
+ * buffers, so a handful can be in use at once (in the same printf, say)
+ * but only on the main thread.
+ */
+char *
+ep_path(struct entry *ep)
+{
+	static int next = 0;
+	static char bufs[4][PATH_MAX];
+
+	next = (next + 1) % 4;
+	return(path_build(PATH_DIR(ep), PATH_NAME(ep), bufs[next]));
+}
+
+/*
+ * List the SHA-256 kernels built in, whether this CPU can run each of
+ * them, and which one would be used.
  */
 void
-entry_free(struct entry *ep)
+kernel_list()
 {
-	if (ep->path != NULL)
-		free((void *)ep->path);
-	if (ep->hash != NULL)
-		free((void *)ep->hash);
-	ep->path = ep->hash = NULL;
-	ep->next = freelist;
-	freelist = ep;
+	struct sha256_kernel *kp, *cur;
+	struct sha256_mb_kernel *mkp, *mcur;
+
+	cur = sha256_current();
+	for (kp = sha256_kernels; kp->name != NULL; kp++)
+		printf("%c %-8s %-28s %s\n", kp == cur ? '*' : ' ', kp->name, kp->desc,
+				kp->probe() ? "available" : "not supported");
+	mcur = sha256_mb_current();
+	for (mkp = sha256_mb_kernels; mkp->name != NULL; mkp++)
+		printf("%c %-8s %-28s %s\n", mkp == mcur ? '*' : ' ', mkp->name, mkp->desc,
+				mkp->probe() ? "available" : "not supported");
+}
+
+/*
+ * Print the statistics gathered during the scan.
+ */
+void
+print_stats()
+{
+	printf("Directories read:           %ld\n", scan.dirs);
+	printf("Directory entries:          %ld\n", scan.entries);
+	printf("Stat calls:                 %ld\n", scan.stats);
+	if (snap_file != NULL)
+		printf("Directories from snapshot:  %ld\n", stats.snap_dirs);
+	printf("Path storage:               %lu KiB\n", (unsigned long)(path_memory() / 1024));
+	printf("Entry storage:              %lu KiB (%lu entries, %d bytes each)\n",
+			(unsigned long)((slab_memory(&entries) + slab_memory(&infos) +
+			max_paths * sizeof(struct pathref)) / 1024),
+			(unsigned long)entries.n, (int)entries.size);
+	printf("Scan time:                  %.3fs (%d thread%s)\n", scan.elapsed,
+			nthreads, nthreads == 1 ? "" : "s");
+	printf("Scan rate:                  %.0f dirs/s, %.0f entries/s\n",
+			scan.dirs / scan.elapsed, scan.entries / scan.elapsed);
+	printf("Files examined:             %ld\n", stats.files);
+	printf("Unique size:                %ld\n", stats.unique_size);
+	printf("Hard links:                 %ld\n", stats.links);
+	if (collect)
+		printf("Same-size groups:           %ld\n", stats.groups);
+	printf("Rejected on head/tail:      %ld\n", stats.rej_quick);
+	printf("Rejected on middle block:   %ld\n", stats.rej_middle);
+	printf("Rejected on full hash:      %ld\n", stats.rej_hash);
+	printf("Rejected on verify:         %ld\n", stats.rej_verify);
+	printf("Files hashed in full:       %ld\n", stats.hashed);
+	if (physical)
+		printf("No physical extent:         %ld\n", stats.no_extent);
+	if (collect)
+		printf("Compared in lock-step:      %ld\n", stats.compared);
+	if (cache_file != NULL)
+		printf("Hash cache:                 %ld hits, %ld misses, %ld added, %ld dropped, %llu entries\n",
+				stats.cache.hits, stats.cache.misses, stats.cache.added, stats.cache.dropped,
+				(unsigned long long)stats.cache.entries);
+	printf("Duplicates:                 %ld\n", stats.dups);
+	if (link_dups || dedupe)
+		printf("%s         %.3fs\n", link_dups ? "Link replacement:  " : "Extent sharing:    ",
+				replaced.elapsed);
+	if (hash_workers > 0) {
+		printf("Hash workers:               %d (queue depth %d)\n", hash_workers, queue_depth);
+		if (read_backend == HASH_POOL_URING)
+			printf("Read backend:               io_uring (%d of %d workers)\n", pool.uring, hash_workers);
+		else
+			printf("Read backend:               pread\n");
+		printf("Stalled on a full queue:    %.3fs\n", stats.stall_submit);
+		printf("Stalled waiting on digests: %.3fs\n", stats.stall_digest);
+		printf("Hash workers idle:          %.3fs\n", pool.idle);
+		printf("Hash workers blocked:       %.3fs\n", pool.blocked);
+	}
+	if (rates[RATE_READ].limit > 0 || rates[RATE_OPS].limit > 0 || rates[RATE_READ].waited > 0 ||
+			rates[RATE_OPS].waited > 0)
+		printf("Throttled:                  %.3fs reading, %.3fs on metadata\n",
+				rates[RATE_READ].waited / 1e9, rates[RATE_OPS].waited / 1e9);
+	if (hash_direct_min > 0)
+		printf("Direct I/O:                 %ld files, %ld through the cache instead\n",
+				hash_direct_files, hash_direct_fallbacks);
+}
+
+/*
+ * Monotonic time, in seconds.
+ */
+double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
 }
 
 /*
@@ -390,6 +1739,9 @@ entry_free(struct entry *ep)
 void
 usage()
 {
-	fprintf(stderr, "Usage: dupscan [-nv] <dir>\n");
+	fprintf(stderr, "Usage: dupscan [-cDLmnPsv] [-a sha256|xxh3|blake3] [-C cache] [-H list|<kernel>] [-j threads]\n"
+			"               [-w workers [-q depth]] [-R pread|fadvise|mmap|uring] [-S snapshot]\n"
+			"               [-O size] [--verify] [--max-read rate] [--max-ops rate]\n"
+			"               [--limits file] <dir>\n");
 	exit(2);
 }
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Physical extents of a file, by FIEMAP (see extent.h).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#  include <linux/fiemap.h>
+#endif
+
+#include "extent.h"
+#include "ratelimit.h"
+
+/*
+ * Where a file's data starts on the disk. Returns zero, with *physp set
+ * to the byte offset (or EXTENT_NONE), or -1 with errno set if the file
+ * can't be opened.
+ */
+int
+extent_first(const char *path, uint64_t *physp)
+{
+	uint64_t len;
+
+	if (extent_all(path, physp, &len, 1) < 0)
+		return(-1);
+	return(0);
+}
+
+/*
+ * Up to "max" of a file's extents, in file order: the physical byte
+ * offset of each, and its length. An extent which isn't on the disk
+ * yet (delayed allocation), or is stored inline, has an offset of
+ * EXTENT_NONE. Returns the number of extents (zero if there's no
+ * FIEMAP here), or -1 with errno set if the file can't be opened.
+ */
+int
+extent_all(const char *path, uint64_t *phys, uint64_t *lens, int max)
+{
+	int fd, n;
+#ifdef FS_IOC_FIEMAP
+	int i;
+	struct fiemap *fmp;
+	struct fiemap_extent *fep;
+#endif
+
+	*phys = EXTENT_NONE;
+	rate_take(RATE_OPS, 1);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return(-1);
+	n = 0;
+#ifdef FS_IOC_FIEMAP
+	if ((fmp = (struct fiemap *)calloc(1, sizeof(*fmp) + max * sizeof(struct fiemap_extent))) == NULL) {
+		perror("extent_all calloc");
+		exit(1);
+	}
+	fmp->fm_start = 0;
+	fmp->fm_length = FIEMAP_MAX_OFFSET;
+	fmp->fm_extent_count = max;
+	if (ioctl(fd, FS_IOC_FIEMAP, fmp) == 0) {
+		for (i = 0; i < (int)fmp->fm_mapped_extents && i < max; i++) {
+			fep = &fmp->fm_extents[i];
+			if (fep->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))
+				phys[i] = EXTENT_NONE;
+			else
+				phys[i] = fep->fe_physical;
+			lens[i] = fep->fe_length;
+		}
+		n = i;
+	}
+	free((void *)fmp);
+#endif
+	close(fd);
+	return(n);
+}
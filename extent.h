@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Where a file's data starts on the disk, from the FIEMAP ioctl. On a
+ * spinning disk (or a big RAID array of them) reading files in that
+ * order, rather than the order the directory walk found them, turns a
+ * storm of seeks into something like one sweep across the platters.
+ */
+#ifndef _EXTENT_H_
+#define _EXTENT_H_
+
+#include <stdint.h>
+
+/*
+ * What a file without a usable extent gets: nothing written yet, data
+ * inline in the inode, or a filesystem which doesn't do FIEMAP. Those
+ * go last, in the order they were found.
+ */
+#define EXTENT_NONE	UINT64_MAX
+
+int	extent_first(const char *, uint64_t *);
+int	extent_all(const char *, uint64_t *, uint64_t *, int);
+
+#endif /* _EXTENT_H_ */
@@ -0,0 +1,1027 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Read a file directly and compute its digest. The file is pulled in
+ * through one large, page-aligned buffer which is allocated on first
+ * use and then kept for the life of the thread.
+ *
+ * Files of the same size can also be hashed as a batch. We read the
+ * same chunk of each file in turn, then run them all through the
+ * multi-buffer SHA-256 kernel together.
+ *
+ * Before any of that, same-size files can be compared on a few
+ * sampled blocks using a cheap non-cryptographic hash. That's enough
+ * to tell most different files apart without reading them in full.
+ *
+ * How the data gets here can be chosen (-R). Plain reads go through
+ * the page cache like anything else, and leave it there. The "fadvise"
+ * reader tells the kernel we're reading sequentially, and hands back
+ * each range as soon as it's been hashed (POSIX_FADV_DONTNEED), so a
+ * big scan doesn't push everything else out of the cache. The "mmap"
+ * reader maps the file instead, with MADV_SEQUENTIAL, asks for each
+ * window ahead of time (MADV_WILLNEED) and drops it when done. Only a
+ * single file is ever mapped - batches are read with the fadvise
+ * reader. Either way, only what we brought into the cache is dropped.
+ * Which parts of a file were there already is looked up (mincore())
+ * when it's opened, and those are left alone. The kernel only answers
+ * that truthfully for files we own, so nothing else is dropped at all.
+ *
+ * Files over a given size can skip the page cache altogether, with
+ * O_DIRECT. There's no read-ahead then, so hash_file() keeps a few
+ * chunks in flight itself through io_uring (one at a time, if there's
+ * no ring). A filesystem which won't do O_DIRECT - at the open, or at
+ * the first read - gets the file read the ordinary way instead.
+ *
+ * SHA-256 is the default. XXH3-128 and BLAKE3 are much quicker, for
+ * when we don't need a cryptographic guarantee (and can always have
+ * the final pairs compared byte for byte instead).
+ */
+#ifdef __linux__
+#  define _GNU_SOURCE		/* for O_DIRECT */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "uring.h"
+#include "ratelimit.h"
+
+/*
+ * Read buffers. These are per-thread, so the hash pool workers can
+ * each have their own.
+ */
+static __thread unsigned char	*hash_buf = NULL;
+static __thread unsigned char	*hash_mb_buf = NULL;
+static __thread unsigned char	*hash_direct_buf = NULL;
+#ifdef HAVE_URING
+static __thread struct uring	hash_ring;
+static __thread int		hash_ring_state = 0;
+#endif
+
+/*
+ * For the readers which give pages back, which HASH_BUFSIZE chunks of
+ * each open file (by descriptor) had pages in the cache before we got
+ * to it. Those are somebody else's, and hash_drop() leaves them be.
+ * With "all" set, we couldn't tell, so nothing is dropped.
+ */
+struct	hash_kept	{
+	uint64_t	*bits;
+	size_t		max;
+	int		all;
+};
+
+static __thread struct hash_kept	*hash_kept = NULL;
+static __thread int			hash_nkept = 0;
+
+/*
+ * Where hash_mapped() goes back to if the file it has mapped is cut
+ * short under it. A SIGBUS is delivered to the thread which touched
+ * the page, so each thread has its own.
+ */
+static __thread sigjmp_buf		hash_bus_jmp;
+static __thread volatile sig_atomic_t	hash_bus_armed = 0;
+static int				hash_bus_set = 0;
+
+static void	sha256_init_f(union hash_ctx *c)				{ sha256_init(&c->sha256); }
+static void	sha256_update_f(union hash_ctx *c, const void *d, size_t n)	{ sha256_update(&c->sha256, d, n); }
+static void	sha256_final_f(union hash_ctx *c, unsigned char *d)		{ sha256_final(&c->sha256, d); }
+static void	xxh3_init_f(union hash_ctx *c)					{ xxh3_init(&c->xxh3); }
+static void	xxh3_update_f(union hash_ctx *c, const void *d, size_t n)	{ xxh3_update(&c->xxh3, d, n); }
+static void	xxh3_final_f(union hash_ctx *c, unsigned char *d)		{ xxh3_final(&c->xxh3, d); }
+static void	blake3_init_f(union hash_ctx *c)				{ blake3_init(&c->blake3); }
+static void	blake3_update_f(union hash_ctx *c, const void *d, size_t n)	{ blake3_update(&c->blake3, d, n); }
+static void	blake3_final_f(union hash_ctx *c, unsigned char *d)		{ blake3_final(&c->blake3, d); }
+
+struct hash_algo	hash_algos[] = {
+	{"sha256",	"SHA-256 (as sha256sum)",	SHA256_DIGEST_SIZE,
+		sha256_init_f,	sha256_update_f,	sha256_final_f},
+	{"xxh3",	"XXH3-128 (as xxhsum -H2)",	XXH3_DIGEST_SIZE,
+		xxh3_init_f,	xxh3_update_f,		xxh3_final_f},
+	{"blake3",	"BLAKE3 (as b3sum)",		BLAKE3_DIGEST_SIZE,
+		blake3_init_f,	blake3_update_f,	blake3_final_f},
+	{NULL,		NULL,				0,
+		NULL,		NULL,			NULL}
+};
+
+struct hash_algo	*hash_algo = &hash_algos[0];
+
+char	*hash_readers[] = {"pread", "mmap", "fadvise", NULL};
+int	hash_reader = HASH_READ_PLAIN;
+
+/*
+ * Files at least this big are read with O_DIRECT (zero for never), and
+ * how many were, or had to be read through the cache after all.
+ */
+off_t	hash_direct_min = 0;
+long	hash_direct_files = 0;
+long	hash_direct_fallbacks = 0;
+
+int	hash_stream(int, union hash_ctx *);
+int	hash_mapped(int, union hash_ctx *);
+int	hash_direct(int, union hash_ctx *);
+int	hash_direct_rest(int, union hash_ctx *, off_t);
+void	hash_bus(int);
+void	hash_keep(int, struct stat *);
+int	hash_known(struct stat *);
+int	hash_resident(unsigned char *, size_t);
+int	hash_cached(int, off_t, size_t);
+void	hash_drop(int, off_t, off_t);
+ssize_t	hash_read(int, unsigned char *, size_t);
+uint64_t	hash_mix(uint64_t, const unsigned char *, size_t);
+
+/*
+ * Choose the hash algorithm by name. Returns -1 if there's no such
+ * thing.
+ */
+int
+hash_select(const char *name)
+{
+	struct hash_algo *hp;
+
+	for (hp = hash_algos; hp->name != NULL; hp++) {
+		if (strcmp(hp->name, name) == 0) {
+			hash_algo = hp;
+			return(0);
+		}
+	}
+	return(-1);
+}
+
+/*
+ * Hash the named file. Returns zero on success, or -1 with errno set
+ * if the file couldn't be opened or read. The digest is padded out to
+ * HASH_MAX_DIGEST bytes.
+ */
+int
+hash_file(const char *path, unsigned char *digest)
+{
+	int fd, err, n;
+	union hash_ctx ctx;
+
+	if (hash_buf == NULL && posix_memalign((void **)&hash_buf, HASH_ALIGN, HASH_BUFSIZE) != 0) {
+		perror("hash_file malloc");
+		exit(1);
+	}
+	if ((fd = hash_open(path)) < 0)
+		return(-1);
+	hash_algo->init(&ctx);
+	if (hash_direct_on(fd)) {
+		if ((n = hash_direct(fd, &ctx)) < 0 && errno == EINVAL) {
+			/*
+			 * The filesystem took O_DIRECT at the open, but
+			 * not for reading. Start again.
+			 */
+			hash_direct_off(fd);
+			hash_algo->init(&ctx);
+			n = hash_stream(fd, &ctx);
+		}
+	} else if (hash_reader == HASH_READ_MMAP)
+		n = hash_mapped(fd, &ctx);
+	else
+		n = hash_stream(fd, &ctx);
+	err = errno;
+	close(fd);
+	if (n < 0) {
+		errno = err;
+		return(-1);
+	}
+	memset(digest, 0, HASH_MAX_DIGEST);
+	hash_algo->final(&ctx, digest);
+	return(0);
+}
+
+/*
+ * Hash a whole file with pread(), HASH_BUFSIZE bytes at a time. Returns
+ * zero, or -1 with errno set.
+ */
+int
+hash_stream(int fd, union hash_ctx *ctx)
+{
+	off_t off;
+	ssize_t n;
+
+	for (off = 0; (n = pread(fd, hash_buf, HASH_BUFSIZE, off)) != 0; off += n) {
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return(-1);
+		}
+		rate_take(RATE_READ, n);
+		hash_algo->update(ctx, hash_buf, n);
+		hash_drop(fd, off, off + n);
+	}
+	return(0);
+}
+
+/*
+ * Hash a batch of "n" files, which should all be the same size. The
+ * digest for paths[i] goes into digests[i], and errs[i] is set to zero
+ * or to the errno from a failed open/read. Returns the number of files
+ * which couldn't be hashed.
+ *
+ * The files are read in lock-step, HASH_MB_CHUNK bytes at a time. If
+ * they all return the same amount, that round goes through the multi-
+ * buffer code. If a file turns out to be a different size after all
+ * (maybe it's being written to) then it simply drops out of step and
+ * is hashed on its own.
+ *
+ * This is only for SHA-256. The other algorithms are quick enough
+ * (and BLAKE3 does its own SIMD within a file), so for those we just
+ * hash the files one after another.
+ */
+int
+hash_files(const char **paths, int n, unsigned char (*digests)[HASH_MAX_DIGEST], int *errs)
+{
+	int i, j, k, nact, nbad, fd[HASH_MB_FILES], act[HASH_MB_FILES];
+	ssize_t len[HASH_MB_FILES];
+	const unsigned char *data[HASH_MB_FILES];
+	struct sha256_ctx ctx[HASH_MB_FILES], *cp[HASH_MB_FILES];
+
+	if (hash_algo->init != sha256_init_f) {
+		for (nbad = i = 0; i < n; i++) {
+			errs[i] = hash_file(paths[i], digests[i]) < 0 ? errno : 0;
+			nbad += errs[i] != 0;
+		}
+		return(nbad);
+	}
+	if (hash_mb_buf == NULL &&
+			posix_memalign((void **)&hash_mb_buf, HASH_ALIGN, HASH_MB_FILES * HASH_MB_CHUNK) != 0) {
+		perror("hash_files malloc");
+		exit(1);
+	}
+	for (nbad = 0; n > 0; n -= k, paths += k, digests += k, errs += k) {
+		k = n < HASH_MB_FILES ? n : HASH_MB_FILES;
+		for (nact = i = 0; i < k; i++) {
+			if ((fd[i] = hash_open(paths[i])) < 0) {
+				errs[i] = errno;
+				nbad++;
+				continue;
+			}
+			errs[i] = 0;
+			sha256_init(&ctx[i]);
+			act[nact++] = i;
+		}
+		while (nact > 0) {
+			for (i = 0; i < nact; i++) {
+				len[i] = hash_read(fd[act[i]], hash_mb_buf + i * HASH_MB_CHUNK, HASH_MB_CHUNK);
+				data[i] = hash_mb_buf + i * HASH_MB_CHUNK;
+				cp[i] = &ctx[act[i]];
+			}
+			for (i = 1; i < nact && len[i] == len[0]; i++)
+				;
+			if (i == nact && len[0] > 0)
+				sha256_update_multi(cp, nact, data, len[0]);
+			else {
+				for (i = 0; i < nact; i++)
+					if (len[i] > 0)
+						sha256_update(cp[i], data[i], len[i]);
+			}
+			/*
+			 * Anything that came up short is finished, one
+			 * way or another.
+			 */
+			for (i = 0; i < nact; i++) {
+				if (len[i] == HASH_MB_CHUNK)
+					continue;
+				if (len[i] < 0) {
+					errs[act[i]] = errno;
+					nbad++;
+				} else {
+					memset(digests[act[i]], 0, HASH_MAX_DIGEST);
+					sha256_final(cp[i], digests[act[i]]);
+				}
+				close(fd[act[i]]);
+				act[i] = -1;
+			}
+			for (j = i = 0; i < nact; i++)
+				if (act[i] >= 0)
+					act[j++] = act[i];
+			nact = j;
+		}
+	}
+	return(nbad);
+}
+
+/*
+ * Compute a cheap 64-bit hash over "n" blocks of "len" bytes, starting
+ * at each of the given offsets. This is only ever compared against the
+ * same sample from another file of the same size, so the hash doesn't
+ * need to be strong - just quick, and deterministic. Unless we're doing
+ * plain reads, there's no read-ahead, and a block which wasn't in the
+ * cache before (which we can only tell for some files, see
+ * hash_known()) is given back afterwards. Returns zero on success, or
+ * -1 with errno set.
+ */
+int
+hash_sample(const char *path, const off_t *offsets, int n, size_t len, uint64_t *result)
+{
+	int i, fd, err, known, drop;
+	off_t start;
+	ssize_t nread;
+	uint64_t h = 0;
+	struct stat st;
+
+	if (hash_buf == NULL && posix_memalign((void **)&hash_buf, HASH_ALIGN, HASH_BUFSIZE) != 0) {
+		perror("hash_sample malloc");
+		exit(1);
+	}
+	if (len > HASH_BUFSIZE)
+		len = HASH_BUFSIZE;
+	rate_take(RATE_OPS, 1);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return(-1);
+	known = 0;
+	if (hash_reader != HASH_READ_PLAIN) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+		known = fstat(fd, &st) == 0 && hash_known(&st);
+	}
+	for (i = 0; i < n; i++) {
+		drop = known && !hash_cached(fd, offsets[i], len);
+		while ((nread = pread(fd, hash_buf, len, offsets[i])) < 0 && errno == EINTR)
+			;
+		if (nread < 0) {
+			err = errno;
+			close(fd);
+			errno = err;
+			return(-1);
+		}
+		rate_take(RATE_READ, nread);
+		h = hash_mix(h, hash_buf, nread);
+		if (drop && nread > 0) {
+			start = offsets[i] & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+			posix_fadvise(fd, start, offsets[i] + nread - start + sysconf(_SC_PAGESIZE) - 1,
+					POSIX_FADV_DONTNEED);
+		}
+	}
+	close(fd);
+	*result = h;
+	return(0);
+}
+
+/*
+ * A simple multiply/xor-shift mix, eight bytes at a time.
+ */
+uint64_t
+hash_mix(uint64_t h, const unsigned char *cp, size_t len)
+{
+	uint64_t w;
+
+	for (; len >= 8; cp += 8, len -= 8) {
+		memcpy(&w, cp, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	while (len-- > 0)
+		h = (h ^ *cp++) * 0x100000001b3ULL;
+	return(h ^ (h >> 32));
+}
+
+/*
+ * Choose how files are read by name. Returns -1 if there's no such
+ * thing.
+ */
+int
+hash_reader_select(const char *name)
+{
+	int i;
+
+	for (i = 0; hash_readers[i] != NULL; i++) {
+		if (strcmp(hash_readers[i], name) == 0) {
+			hash_reader = i;
+			return(0);
+		}
+	}
+	return(-1);
+}
+
+/*
+ * Open a file to be read from start to finish. Unless we're doing plain
+ * reads, let the kernel know, and note what of it is cached already.
+ */
+int
+hash_open(const char *path)
+{
+	int fd;
+	struct stat st;
+
+	rate_take(RATE_OPS, 1);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return(-1);
+	if (fstat(fd, &st) < 0)
+		st.st_size = -1;
+	if (hash_reader != HASH_READ_PLAIN) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		hash_keep(fd, st.st_size >= 0 ? &st : NULL);
+	}
+#ifdef O_DIRECT
+	if (hash_direct_min > 0 && st.st_size >= hash_direct_min) {
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0)
+			__atomic_add_fetch(&hash_direct_files, 1, __ATOMIC_RELAXED);
+		else
+			__atomic_add_fetch(&hash_direct_fallbacks, 1, __ATOMIC_RELAXED);
+	}
+#endif
+	return(fd);
+}
+
+/*
+ * Is this file being read with O_DIRECT?
+ */
+int
+hash_direct_on(int fd)
+{
+#ifdef O_DIRECT
+	return(hash_direct_min > 0 && (fcntl(fd, F_GETFL) & O_DIRECT) != 0);
+#else
+	return(0);
+#endif
+}
+
+/*
+ * The filesystem won't read this file with O_DIRECT after all, so go
+ * through the cache.
+ */
+void
+hash_direct_off(int fd)
+{
+#ifdef O_DIRECT
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+	__atomic_add_fetch(&hash_direct_files, -1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hash_direct_fallbacks, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+ * Hash a whole file opened with O_DIRECT. Up to HASH_DIRECT_BUFS chunks
+ * are kept in flight through io_uring, each into its own buffer from a
+ * per-thread pool, and they're hashed in order as they land. The ring
+ * is set up on first use, and kept for the life of the thread. Without
+ * one, it's a pread() at a time. A short read doesn't have to be the
+ * end of the file, so whatever's left after one is read by
+ * hash_direct_rest(). Returns zero, or -1 with errno set - EINVAL
+ * means the filesystem won't do it.
+ */
+int
+hash_direct(int fd, union hash_ctx *ctx)
+{
+	off_t off;
+	ssize_t n;
+#ifdef HAVE_URING
+	int i, k, err, stop, inflight, state[HASH_DIRECT_BUFS];
+	off_t next, size;
+	ssize_t res[HASH_DIRECT_BUFS];
+	struct stat st;
+	struct iovec iov[HASH_DIRECT_BUFS];
+	struct io_uring_cqe *cqe;
+#endif
+
+	if (hash_direct_buf == NULL &&
+			posix_memalign((void **)&hash_direct_buf, HASH_ALIGN, HASH_DIRECT_BUFS * HASH_BUFSIZE) != 0) {
+		perror("hash_direct malloc");
+		exit(1);
+	}
+#ifdef HAVE_URING
+	if (hash_ring_state == 0) {
+		hash_ring_state = -1;
+		for (i = 0; i < HASH_DIRECT_BUFS; i++) {
+			iov[i].iov_base = hash_direct_buf + i * HASH_BUFSIZE;
+			iov[i].iov_len = HASH_BUFSIZE;
+		}
+		if (uring_init(&hash_ring, HASH_DIRECT_BUFS) == 0) {
+			if (uring_register_buffers(&hash_ring, iov, HASH_DIRECT_BUFS) == 0)
+				hash_ring_state = 1;
+			else
+				uring_exit(&hash_ring);
+		}
+	}
+	if (hash_ring_state > 0) {
+		if (fstat(fd, &st) < 0)
+			return(-1);
+		size = st.st_size;
+		for (next = inflight = i = 0; i < HASH_DIRECT_BUFS; i++) {
+			state[i] = 0;
+			if (next < size) {
+				uring_read_fixed(&hash_ring, fd, hash_direct_buf + i * HASH_BUFSIZE,
+						HASH_BUFSIZE, next, i, i);
+				state[i] = 1;
+				inflight++;
+				next += HASH_BUFSIZE;
+			}
+		}
+		/*
+		 * Slot "k" always has the chunk at "off", which is the
+		 * next to be hashed. A slot is idle, in flight, or has
+		 * landed (with the result in res[]). Once we've hit an
+		 * error or the end of the file, whatever's still in
+		 * flight is just waited for.
+		 */
+		for (off = err = stop = k = 0; inflight > 0;) {
+			while (state[k] == 1) {
+				if (uring_submit_wait(&hash_ring, 1) < 0) {
+					perror("hash_direct io_uring_enter");
+					exit(1);
+				}
+				while ((cqe = uring_peek(&hash_ring)) != NULL) {
+					res[cqe->user_data] = cqe->res;
+					state[cqe->user_data] = 2;
+					uring_seen(&hash_ring);
+				}
+			}
+			if (state[k] == 0) {
+				k = (k + 1) % HASH_DIRECT_BUFS;
+				continue;
+			}
+			state[k] = 0;
+			inflight--;
+			if (stop)
+				continue;
+			if ((n = res[k]) == -EINTR || n == -EAGAIN) {
+				uring_read_fixed(&hash_ring, fd, hash_direct_buf + k * HASH_BUFSIZE,
+						HASH_BUFSIZE, off, k, k);
+				state[k] = 1;
+				inflight++;
+				continue;
+			}
+			if (n < 0) {
+				err = -n;
+				stop = 1;
+				continue;
+			}
+			rate_take(RATE_READ, n);
+			hash_algo->update(ctx, hash_direct_buf + k * HASH_BUFSIZE, n);
+			off += n;
+			if (n < HASH_BUFSIZE)
+				stop = 1;
+			else if (next < size) {
+				uring_read_fixed(&hash_ring, fd, hash_direct_buf + k * HASH_BUFSIZE,
+						HASH_BUFSIZE, next, k, k);
+				state[k] = 1;
+				inflight++;
+				next += HASH_BUFSIZE;
+			}
+			k = (k + 1) % HASH_DIRECT_BUFS;
+		}
+		if (err != 0) {
+			errno = err;
+			return(-1);
+		}
+		return(hash_direct_rest(fd, ctx, off));
+	}
+#endif
+	for (off = 0; (n = pread(fd, hash_direct_buf, HASH_BUFSIZE, off)) != 0; off += n) {
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return(-1);
+		}
+		rate_take(RATE_READ, n);
+		hash_algo->update(ctx, hash_direct_buf, n);
+		if (n < HASH_BUFSIZE)
+			return(hash_direct_rest(fd, ctx, off + n));
+	}
+	return(0);
+}
+
+/*
+ * Carry on with a file hash_direct() was reading, from "off" (just
+ * after a short read) until a read comes back empty. O_DIRECT can't go
+ * on from an offset that isn't aligned, so this goes through the cache.
+ * Usually it's just the one read, at the end of the file.
+ */
+int
+hash_direct_rest(int fd, union hash_ctx *ctx, off_t off)
+{
+	ssize_t n;
+
+#ifdef O_DIRECT
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+	for (; (n = pread(fd, hash_direct_buf, HASH_BUFSIZE, off)) != 0; off += n) {
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return(-1);
+		}
+		rate_take(RATE_READ, n);
+		hash_algo->update(ctx, hash_direct_buf, n);
+	}
+	return(0);
+}
+
+/*
+ * Hash a whole file through a mapping, HASH_BUFSIZE bytes at a time.
+ * The next window is asked for while this one is hashed, and each one
+ * is unmapped (so its pages aren't ours any more) and dropped from the
+ * cache once it's done with. Returns zero, or -1 with errno set.
+ *
+ * A file truncated while it's mapped gets us a SIGBUS when we touch a
+ * page past the new end. That's caught (see hash_bus()), and the file
+ * is reported as unreadable (EIO) - it's changing under us, so its
+ * digest wouldn't mean much anyway.
+ */
+int
+hash_mapped(int fd, union hash_ctx *ctx)
+{
+	size_t off, n, size;
+	unsigned char *p;
+	struct stat st;
+	struct sigaction sa;
+
+	if (fstat(fd, &st) < 0)
+		return(-1);
+	if ((size = st.st_size) == 0)
+		return(0);
+	if (!__atomic_exchange_n(&hash_bus_set, 1, __ATOMIC_ACQ_REL)) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = hash_bus;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGBUS, &sa, NULL);
+	}
+	if ((p = (unsigned char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return(-1);
+	if (sigsetjmp(hash_bus_jmp, 1) != 0) {
+		munmap(p, size);
+		errno = EIO;
+		return(-1);
+	}
+	hash_bus_armed = 1;
+	madvise(p, size, MADV_SEQUENTIAL);
+	for (off = 0; off < size; off += n) {
+		n = size - off < HASH_BUFSIZE ? size - off : HASH_BUFSIZE;
+		if (off + n < size)
+			madvise(p + off + n, size - off - n < HASH_BUFSIZE ? size - off - n : HASH_BUFSIZE,
+					MADV_WILLNEED);
+		rate_take(RATE_READ, n);
+		hash_algo->update(ctx, p + off, n);
+		madvise(p + off, n, MADV_DONTNEED);
+		hash_drop(fd, off, off + n);
+	}
+	hash_bus_armed = 0;
+	munmap(p, size);
+	return(0);
+}
+
+/*
+ * SIGBUS handler. If it happened inside hash_mapped()'s loop, go back
+ * there. Anything else is a real fault: put the default action back
+ * and return, so the same access faults again and takes us down.
+ */
+void
+hash_bus(int sig)
+{
+	if (!hash_bus_armed) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+	hash_bus_armed = 0;
+	siglongjmp(hash_bus_jmp, 1);
+}
+
+/*
+ * Note which chunks of a file just opened have any pages in the cache,
+ * by mapping it and asking mincore(). Nothing is read. If we can't
+ * tell (see hash_known()), or the file can't be mapped, all of it is
+ * kept.
+ */
+void
+hash_keep(int fd, struct stat *sp)
+{
+	int n;
+	size_t c, nchunks, len;
+	unsigned char *p;
+	struct hash_kept *kp;
+
+	if (fd >= hash_nkept) {
+		n = fd + 1 > hash_nkept * 2 ? fd + 1 : hash_nkept * 2;
+		if ((hash_kept = (struct hash_kept *)realloc(hash_kept, n * sizeof(*hash_kept))) == NULL) {
+			perror("hash_keep realloc");
+			exit(1);
+		}
+		memset(hash_kept + hash_nkept, 0, (n - hash_nkept) * sizeof(*hash_kept));
+		hash_nkept = n;
+	}
+	kp = &hash_kept[fd];
+	kp->all = 1;
+	if (sp == NULL || sp->st_size <= 0 || !hash_known(sp) ||
+	    (p = (unsigned char *)mmap(NULL, sp->st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return;
+	nchunks = (sp->st_size + HASH_BUFSIZE - 1) / HASH_BUFSIZE;
+	if (nchunks > kp->max * 64) {
+		kp->max = (nchunks + 63) / 64;
+		if ((kp->bits = (uint64_t *)realloc(kp->bits, kp->max * sizeof(uint64_t))) == NULL) {
+			perror("hash_keep realloc");
+			exit(1);
+		}
+	}
+	memset(kp->bits, 0, (nchunks + 63) / 64 * sizeof(uint64_t));
+	for (c = 0; c < nchunks; c++) {
+		len = sp->st_size - c * HASH_BUFSIZE < HASH_BUFSIZE ? sp->st_size - c * HASH_BUFSIZE : HASH_BUFSIZE;
+		if (hash_resident(p + c * HASH_BUFSIZE, len))
+			kp->bits[c / 64] |= 1ULL << (c % 64);
+	}
+	munmap(p, sp->st_size);
+	kp->all = 0;
+}
+
+/*
+ * Will mincore() tell us the truth about a file? Since Linux 5.2, it
+ * only reports the page cache for a file we own or could write to, and
+ * says nothing is cached for anything else. Owning it (or being root)
+ * is the test here - a file we could only write through its mode bits
+ * isn't worth the risk of getting it wrong.
+ */
+int
+hash_known(struct stat *sp)
+{
+	return(sp->st_uid == geteuid() || geteuid() == 0);
+}
+
+/*
+ * Are any of the "len" bytes (at most HASH_BUFSIZE, plus a page) of a
+ * mapping at "p" (which is page-aligned) in the cache? If mincore()
+ * fails, say yes.
+ */
+int
+hash_resident(unsigned char *p, size_t len)
+{
+	size_t i, n, pagesize;
+	unsigned char vec[HASH_BUFSIZE / HASH_ALIGN + 1];
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	n = (len + pagesize - 1) / pagesize;
+	if (mincore(p, len, vec) < 0)
+		return(1);
+	for (i = 0; i < n; i++)
+		if ((vec[i] & 1) != 0)
+			return(1);
+	return(0);
+}
+
+/*
+ * Are any of the "len" bytes at "off" in a file in the cache? Just that
+ * much of it is mapped to find out.
+ */
+int
+hash_cached(int fd, off_t off, size_t len)
+{
+	int cached;
+	off_t start;
+	unsigned char *p;
+
+	start = off & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+	len += off - start;
+	if ((p = (unsigned char *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start)) == MAP_FAILED)
+		return(1);
+	cached = hash_resident(p, len);
+	munmap(p, len);
+	return(cached);
+}
+
+/*
+ * We're done with the range "start" to "end" of a file. Unless we're
+ * doing plain reads, tell the kernel it can have the pages back - but
+ * only in chunks which weren't cached before we opened it. The cache
+ * can hold a file in pages much bigger than what we read at a time,
+ * and one of those which is only partly in the range isn't dropped, so
+ * the range is taken back HASH_DROP_BACK bytes to catch any left
+ * straddling the start of it last time.
+ */
+void
+hash_drop(int fd, off_t start, off_t end)
+{
+	off_t c, from;
+	struct hash_kept *kp;
+
+	if (hash_reader == HASH_READ_PLAIN || fd >= hash_nkept || end <= start)
+		return;
+	if ((kp = &hash_kept[fd])->all)
+		return;
+	start = start > HASH_DROP_BACK ? start - HASH_DROP_BACK : 0;
+	for (from = -1, c = start / HASH_BUFSIZE; c * HASH_BUFSIZE < end; c++) {
+		if ((kp->bits[c / 64] & (1ULL << (c % 64))) == 0) {
+			if (from < 0)
+				from = c * HASH_BUFSIZE > start ? c * HASH_BUFSIZE : start;
+		} else if (from >= 0) {
+			posix_fadvise(fd, from, c * HASH_BUFSIZE - from, POSIX_FADV_DONTNEED);
+			from = -1;
+		}
+	}
+	if (from >= 0)
+		posix_fadvise(fd, from, end - from, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Fill a buffer from a file, as far as possible. Returns the number of
+ * bytes read, which is less than asked for only at end-of-file, or -1
+ * on error. What's been read is dropped (see hash_drop()), so this is
+ * only for reading a file from start to finish. If O_DIRECT turns out
+ * not to work, the rest of the file is read through the cache.
+ */
+ssize_t
+hash_read(int fd, unsigned char *buf, size_t size)
+{
+	off_t off;
+	ssize_t n;
+	size_t got = 0;
+
+	while (got < size) {
+		if ((n = read(fd, buf + got, size - got)) == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL && hash_direct_on(fd)) {
+				hash_direct_off(fd);
+				continue;
+			}
+			return(-1);
+		}
+		got += n;
+		rate_take(RATE_READ, n);
+	}
+	if (hash_reader != HASH_READ_PLAIN && got > 0) {
+		off = lseek(fd, 0, SEEK_CUR);
+		hash_drop(fd, off - got, off);
+	}
+	return(got);
+}
+
+/*
+ * Compare two files byte for byte. Returns 1 if they're identical, 0 if
+ * not, or -1 with errno set if either can't be read. This is the final
+ * word for --verify, after the digests say two files are the same.
+ */
+int
+compare_files(const char *path1, const char *path2)
+{
+	int fd1, fd2, err, same;
+	ssize_t n1, n2;
+	unsigned char *buf1, *buf2;
+
+	if (hash_mb_buf == NULL &&
+			posix_memalign((void **)&hash_mb_buf, HASH_ALIGN, HASH_MB_FILES * HASH_MB_CHUNK) != 0) {
+		perror("compare_files malloc");
+		exit(1);
+	}
+	buf1 = hash_mb_buf;
+	buf2 = hash_mb_buf + HASH_MB_CHUNK;
+	if ((fd1 = hash_open(path1)) < 0)
+		return(-1);
+	if ((fd2 = hash_open(path2)) < 0) {
+		err = errno;
+		close(fd1);
+		errno = err;
+		return(-1);
+	}
+	for (same = 1, err = 0; same;) {
+		n1 = hash_read(fd1, buf1, HASH_MB_CHUNK);
+		n2 = hash_read(fd2, buf2, HASH_MB_CHUNK);
+		if (n1 < 0 || n2 < 0) {
+			err = errno;
+			same = -1;
+			break;
+		}
+		if (n1 != n2 || memcmp(buf1, buf2, n1) != 0)
+			same = 0;
+		if (n1 < HASH_MB_CHUNK)
+			break;
+	}
+	close(fd1);
+	close(fd2);
+	errno = err;
+	return(same);
+}
+
+/*
+ * Split a group of "n" files (at most HASH_MB_FILES), which should all
+ * be the same size, into classes of identical files. class[i] is set to
+ * the first file with the same contents as paths[i] (so it's "i" if
+ * there's no earlier one), and errs[i] to zero or to the errno from a
+ * failed open/read. A file which can't be read is in a class of its
+ * own. Returns the number of files which couldn't be read.
+ *
+ * The files are read in lock-step, HASH_MB_CHUNK bytes at a time, and
+ * each round's chunk is compared against the first file of each class
+ * it was in. A class which disagrees splits. A file stops being read
+ * as soon as it's in a class of its own, so a group of files which all
+ * differ early on costs a chunk per file, rather than every byte.
+ */
+int
+compare_group(const char **paths, int n, int *class, int *errs)
+{
+	int i, j, k, nact, nbad, fd[HASH_MB_FILES], act[HASH_MB_FILES];
+	int old[HASH_MB_FILES], count[HASH_MB_FILES];
+	ssize_t len[HASH_MB_FILES];
+	unsigned char *buf[HASH_MB_FILES];
+
+	if (hash_mb_buf == NULL &&
+			posix_memalign((void **)&hash_mb_buf, HASH_ALIGN, HASH_MB_FILES * HASH_MB_CHUNK) != 0) {
+		perror("compare_group malloc");
+		exit(1);
+	}
+	for (nbad = nact = i = 0; i < n; i++) {
+		class[i] = i;
+		buf[i] = hash_mb_buf + i * HASH_MB_CHUNK;
+		if ((fd[i] = hash_open(paths[i])) < 0) {
+			errs[i] = errno;
+			nbad++;
+			continue;
+		}
+		errs[i] = 0;
+		act[nact++] = i;
+	}
+	for (i = 0; i < nact; i++)
+		class[act[i]] = act[0];
+	while (nact > 0) {
+		for (i = 0; i < nact; i++) {
+			k = act[i];
+			if ((len[k] = hash_read(fd[k], buf[k], HASH_MB_CHUNK)) < 0) {
+				errs[k] = errno;
+				nbad++;
+			}
+		}
+		/*
+		 * Refine. The files are in order, so the first file
+		 * of each class is always looked at before the rest.
+		 * A file joins the first of the new classes, split
+		 * from its old one, that it agrees with.
+		 */
+		for (i = 0; i < nact; i++) {
+			k = act[i];
+			old[k] = class[k];
+			count[k] = 0;
+		}
+		for (i = 0; i < nact; i++) {
+			k = act[i];
+			if (errs[k] != 0) {
+				class[k] = k;
+				continue;
+			}
+			for (j = 0; j < i; j++) {
+				if (class[act[j]] != act[j] || old[act[j]] != old[k] || errs[act[j]] != 0)
+					continue;
+				if (len[act[j]] == len[k] && memcmp(buf[act[j]], buf[k], len[k]) == 0)
+					break;
+			}
+			class[k] = j < i ? act[j] : k;
+			count[class[k]]++;
+		}
+		/*
+		 * Anything in a class of its own is settled, as is
+		 * everything that's come to the end of the file.
+		 */
+		for (j = i = 0; i < nact; i++) {
+			k = act[i];
+			if (errs[k] == 0 && count[class[k]] > 1 && len[k] == HASH_MB_CHUNK)
+				act[j++] = k;
+			else
+				close(fd[k]);
+		}
+		nact = j;
+	}
+	return(nbad);
+}
+
+/*
+ * Convert a binary digest into the lower-case hex string that the
+ * sha256sum command would print.
+ */
+void
+hash_hex(const unsigned char *digest, size_t len, char *str)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+
+	while (len-- > 0) {
+		*str++ = hexdigits[*digest >> 4];
+		*str++ = hexdigits[*digest++ & 0xf];
+	}
+	*str = '\0';
+}
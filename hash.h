@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Read a file and compute its digest, in-process, with whichever of the
+ * supported hash algorithms has been selected.
+ */
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
+
+#include "sha256.h"
+#include "xxh3.h"
+#include "blake3.h"
+
+/*
+ * Files are read in large chunks into a page-aligned buffer.
+ */
+#define HASH_BUFSIZE	(1024 * 1024)
+#define HASH_ALIGN	4096
+
+/*
+ * How far back to go when giving pages back to the cache (see
+ * hash_drop()). This is the biggest page the cache is likely to use.
+ */
+#define HASH_DROP_BACK	(2 * 1024 * 1024)
+
+/*
+ * Batches of same-size files are read HASH_MB_CHUNK bytes at a time,
+ * up to HASH_MB_FILES files at once.
+ */
+#define HASH_MB_FILES	16
+#define HASH_MB_CHUNK	(256 * 1024)
+
+/*
+ * The prefilter samples PREFILTER_BLOCK bytes from the start and end
+ * of a file (and optionally the middle). It's not worth it for small
+ * files, which we may as well just read in full.
+ */
+#define PREFILTER_BLOCK	4096
+#define PREFILTER_MIN	(64 * 1024)
+
+/*
+ * How files are read (see hash.c). The names are in hash_readers[], in
+ * the same order.
+ */
+#define HASH_READ_PLAIN		0
+#define HASH_READ_MMAP		1
+#define HASH_READ_FADVISE	2
+
+/*
+ * Files read with O_DIRECT (see hash_direct_min) have this many chunks
+ * of HASH_BUFSIZE in flight at once.
+ */
+#define HASH_DIRECT_BUFS	4
+
+/*
+ * Room for the largest digest of any of the algorithms. Shorter digests
+ * are zero-padded to this size, so two digests can always be compared
+ * as a whole.
+ */
+#define HASH_MAX_DIGEST	32
+
+union	hash_ctx	{
+	struct sha256_ctx	sha256;
+	struct xxh3_ctx		xxh3;
+	struct blake3_ctx	blake3;
+};
+
+/*
+ * A hash algorithm, and the size of the digest it produces.
+ */
+struct	hash_algo	{
+	char	*name;
+	char	*desc;
+	int	size;
+	void	(*init)(union hash_ctx *);
+	void	(*update)(union hash_ctx *, const void *, size_t);
+	void	(*final)(union hash_ctx *, unsigned char *);
+};
+
+extern struct hash_algo	hash_algos[];
+extern struct hash_algo	*hash_algo;
+extern char		*hash_readers[];
+extern int		hash_reader;
+extern off_t		hash_direct_min;
+extern long		hash_direct_files;
+extern long		hash_direct_fallbacks;
+
+/*
+ * Compare two (padded) digests. This is two 128-bit compares and no
+ * branches, rather than a byte-by-byte memcmp().
+ */
+static inline int
+digest_equal(const unsigned char *d1, const unsigned char *d2)
+{
+#if defined(__SSE2__)
+	__m128i x;
+
+	x = _mm_or_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)d1), _mm_loadu_si128((const __m128i *)d2)),
+		_mm_xor_si128(_mm_loadu_si128((const __m128i *)(d1 + 16)), _mm_loadu_si128((const __m128i *)(d2 + 16))));
+	return(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) == 0xffff);
+#elif defined(__aarch64__)
+	uint8x16_t x;
+
+	x = vorrq_u8(veorq_u8(vld1q_u8(d1), vld1q_u8(d2)), veorq_u8(vld1q_u8(d1 + 16), vld1q_u8(d2 + 16)));
+	return(vmaxvq_u8(x) == 0);
+#else
+	return(memcmp(d1, d2, HASH_MAX_DIGEST) == 0);
+#endif
+}
+
+int	hash_select(const char *);
+int	hash_reader_select(const char *);
+int	hash_open(const char *);
+int	hash_direct_on(int);
+void	hash_direct_off(int);
+int	hash_file(const char *, unsigned char *);
+int	hash_files(const char **, int, unsigned char (*)[HASH_MAX_DIGEST], int *);
+int	hash_sample(const char *, const off_t *, int, size_t, uint64_t *);
+int	compare_files(const char *, const char *);
+int	compare_group(const char **, int, int *, int *);
+void	hash_hex(const unsigned char *, size_t, char *);
+
+#endif /* _HASH_H_ */
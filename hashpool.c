@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Hash worker pool. The workers pull requests off a lock-free queue,
+ * hash the file with hash_file() (each thread has its own read buffer)
+ * and push the request onto the completion queue. Nothing here ever
+ * sleeps on a lock - a worker with no work spins briefly, then yields,
+ * then naps, and counts how long it spent doing so.
+ *
+ * With the io_uring backend, each worker instead keeps a set of files
+ * open at once, with one read outstanding for each. All the new reads
+ * go to the kernel in one system call, which also waits for the next
+ * completion. A file's digest is updated as each chunk lands, and the
+ * next chunk is queued straight away. If the ring can't be set up (an
+ * old kernel, or a seccomp policy that blocks it) the worker quietly
+ * falls back to pread(). Files are opened as hash_file() would, so a
+ * big one is read with O_DIRECT if that's been asked for.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "hashpool.h"
+#include "mpmc.h"
+#include "uring.h"
+#include "ratelimit.h"
+
+struct	hash_worker	{
+	pthread_t	thread;
+	double		idle;
+	double		blocked;
+	int		uring;
+} __attribute__((aligned(64)));
+
+/*
+ * A file in flight on an io_uring worker.
+ */
+struct	hash_slot	{
+	struct hash_req	*rp;
+	int		fd;
+	off_t		off;
+	union hash_ctx	ctx;
+};
+
+static struct mpmc_queue	hash_reqq;
+static struct mpmc_queue	hash_doneq;
+static struct hash_worker	*hash_workers;
+static int			hash_nworkers;
+static int			hash_backend;
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define cpu_relax()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#  define cpu_relax()	__asm__ __volatile__("yield")
+#else
+#  define cpu_relax()
+#endif
+
+static void	*hash_worker(void *);
+static struct hash_req	*hash_next(struct hash_worker *, int);
+static void	hash_return(struct hash_worker *, struct hash_req *);
+#ifdef HAVE_URING
+static int	hash_uring(struct hash_worker *);
+#endif
+static double	hash_now();
+
+/*
+ * Start "nworkers" hash threads, with room for "depth" requests in the
+ * queue, using the given read backend. The completion queue has room
+ * for everything that can be in flight, so the workers shouldn't
+ * normally have to wait on it.
+ */
+void
+hash_pool_start(int nworkers, int depth, int backend)
+{
+	int i;
+	union hash_ctx ctx;
+	unsigned char digest[HASH_MAX_DIGEST];
+
+	/*
+	 * Get any lazy kernel selection done now, before there are
+	 * threads about.
+	 */
+	hash_algo->init(&ctx);
+	hash_algo->update(&ctx, digest, 0);
+	hash_algo->final(&ctx, digest);
+	if (nworkers > HASH_POOL_MAX)
+		nworkers = HASH_POOL_MAX;
+	hash_backend = backend;
+	mpmc_init(&hash_reqq, depth);
+	mpmc_init(&hash_doneq, depth + nworkers * (backend == HASH_POOL_URING ? HASH_URING_FILES : 1) + 1);
+	if ((hash_workers = (struct hash_worker *)aligned_alloc(64, nworkers * sizeof(struct hash_worker))) == NULL) {
+		perror("hash_pool_start malloc");
+		exit(1);
+	}
+	hash_nworkers = nworkers;
+	for (i = 0; i < nworkers; i++) {
+		hash_workers[i].idle = hash_workers[i].blocked = 0.0;
+		hash_workers[i].uring = 0;
+		if (pthread_create(&hash_workers[i].thread, NULL, hash_worker, &hash_workers[i]) != 0) {
+			perror("hash_pool_start pthread_create");
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Queue a request. Returns zero if the queue is full, in which case
+ * the caller should reap some results and try again.
+ */
+int
+hash_pool_submit(struct hash_req *rp)
+{
+	return(mpmc_push(&hash_reqq, rp));
+}
+
+/*
+ * Collect a finished request, or NULL if there aren't any (yet).
+ */
+struct hash_req *
+hash_pool_reap()
+{
+	void *rp;
+
+	return(mpmc_pop(&hash_doneq, &rp) ? (struct hash_req *)rp : NULL);
+}
+
+/*
+ * Tell the workers to finish up, wait for them, and add up how much
+ * time they spent waiting. Everything submitted should have been
+ * reaped by now.
+ */
+void
+hash_pool_stop(struct hash_pool_stats *hpsp)
+{
+	int i, spins;
+
+	for (i = 0; i < hash_nworkers; i++)
+		for (spins = 0; !mpmc_push(&hash_reqq, NULL); spins++)
+			hash_pause(spins);
+	hpsp->idle = hpsp->blocked = 0.0;
+	hpsp->uring = 0;
+	for (i = 0; i < hash_nworkers; i++) {
+		pthread_join(hash_workers[i].thread, NULL);
+		hpsp->idle += hash_workers[i].idle;
+		hpsp->blocked += hash_workers[i].blocked;
+		hpsp->uring += hash_workers[i].uring;
+	}
+	free((void *)hash_workers);
+	mpmc_free(&hash_reqq);
+	mpmc_free(&hash_doneq);
+	hash_workers = NULL;
+	hash_nworkers = 0;
+}
+
+/*
+ * A hash thread. A NULL request means it's time to go home.
+ */
+static void *
+hash_worker(void *arg)
+{
+	struct hash_req *rp;
+	struct hash_worker *wp = (struct hash_worker *)arg;
+
+#ifdef HAVE_URING
+	if (hash_backend == HASH_POOL_URING && hash_uring(wp) == 0)
+		return(NULL);
+#endif
+	while ((rp = hash_next(wp, 1)) != NULL) {
+		rp->error = hash_file(rp->path, rp->digest) < 0 ? errno : 0;
+		hash_return(wp, rp);
+	}
+	return(NULL);
+}
+
+/*
+ * Get the next request. If "wait" isn't set and there's nothing there,
+ * returns (void *)-1 rather than hanging about.
+ */
+static struct hash_req *
+hash_next(struct hash_worker *wp, int wait)
+{
+	int spins;
+	void *p;
+	double t0;
+
+	if (!mpmc_pop(&hash_reqq, &p)) {
+		if (!wait)
+			return((struct hash_req *)-1);
+		t0 = hash_now();
+		for (spins = 0; !mpmc_pop(&hash_reqq, &p); spins++)
+			hash_pause(spins);
+		wp->idle += hash_now() - t0;
+	}
+	return((struct hash_req *)p);
+}
+
+/*
+ * Hand back a finished request.
+ */
+static void
+hash_return(struct hash_worker *wp, struct hash_req *rp)
+{
+	int spins;
+	double t0;
+
+	if (mpmc_push(&hash_doneq, rp))
+		return;
+	t0 = hash_now();
+	for (spins = 0; !mpmc_push(&hash_doneq, rp); spins++)
+		hash_pause(spins);
+	wp->blocked += hash_now() - t0;
+}
+
+#ifdef HAVE_URING
+/*
+ * The io_uring version of the worker. Returns -1 straight away if it
+ * can't get a ring going, otherwise 0 once it's been told to stop and
+ * everything in flight is done.
+ */
+static int
+hash_uring(struct hash_worker *wp)
+{
+	int i, stop, inflight, nfree, freelist[HASH_URING_FILES];
+	unsigned char *bufs;
+	struct uring ring;
+	struct hash_req *rp;
+	struct hash_slot *sp, slots[HASH_URING_FILES];
+	struct iovec iov[HASH_URING_FILES];
+	struct io_uring_cqe *cqe;
+
+	if (uring_init(&ring, HASH_URING_FILES) < 0)
+		return(-1);
+	if (posix_memalign((void **)&bufs, HASH_ALIGN, HASH_URING_FILES * HASH_URING_CHUNK) != 0) {
+		perror("hash_uring malloc");
+		exit(1);
+	}
+	for (i = 0; i < HASH_URING_FILES; i++) {
+		iov[i].iov_base = bufs + i * HASH_URING_CHUNK;
+		iov[i].iov_len = HASH_URING_CHUNK;
+		freelist[i] = i;
+	}
+	if (uring_register_buffers(&ring, iov, HASH_URING_FILES) < 0) {
+		uring_exit(&ring);
+		free((void *)bufs);
+		return(-1);
+	}
+	wp->uring = 1;
+	for (stop = inflight = 0, nfree = HASH_URING_FILES;;) {
+		/*
+		 * Fill any empty slots. Only wait for work if we've
+		 * nothing else to be getting on with.
+		 */
+		while (!stop && nfree > 0) {
+			if ((rp = hash_next(wp, inflight == 0)) == (struct hash_req *)-1)
+				break;
+			if (rp == NULL) {
+				stop = 1;
+				break;
+			}
+			sp = &slots[i = freelist[--nfree]];
+			if ((sp->fd = hash_open(rp->path)) < 0) {
+				rp->error = errno;
+				freelist[nfree++] = i;
+				hash_return(wp, rp);
+				continue;
+			}
+			sp->rp = rp;
+			sp->off = 0;
+			hash_algo->init(&sp->ctx);
+			uring_read_fixed(&ring, sp->fd, iov[i].iov_base, HASH_URING_CHUNK, 0, i, i);
+			inflight++;
+		}
+		if (inflight == 0) {
+			if (stop)
+				break;
+			continue;
+		}
+		if (uring_submit_wait(&ring, 1) < 0) {
+			perror("hash_uring io_uring_enter");
+			exit(1);
+		}
+		while ((cqe = uring_peek(&ring)) != NULL) {
+			sp = &slots[i = cqe->user_data];
+			if (cqe->res > 0) {
+				/*
+				 * Another chunk. Hash it and ask for the
+				 * next one.
+				 */
+				rate_take(RATE_READ, cqe->res);
+				hash_algo->update(&sp->ctx, iov[i].iov_base, cqe->res);
+				sp->off += cqe->res;
+				uring_read_fixed(&ring, sp->fd, iov[i].iov_base, HASH_URING_CHUNK, sp->off, i, i);
+			} else if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+				uring_read_fixed(&ring, sp->fd, iov[i].iov_base, HASH_URING_CHUNK, sp->off, i, i);
+			else if (cqe->res == -EINVAL && hash_direct_on(sp->fd)) {
+				/*
+				 * No O_DIRECT here after all. Try that
+				 * again through the cache.
+				 */
+				hash_direct_off(sp->fd);
+				uring_read_fixed(&ring, sp->fd, iov[i].iov_base, HASH_URING_CHUNK, sp->off, i, i);
+			} else {
+				/*
+				 * End of file, or an error.
+				 */
+				close(sp->fd);
+				if ((sp->rp->error = -cqe->res) == 0) {
+					memset(sp->rp->digest, 0, HASH_MAX_DIGEST);
+					hash_algo->final(&sp->ctx, sp->rp->digest);
+				}
+				hash_return(wp, sp->rp);
+				freelist[nfree++] = i;
+				inflight--;
+			}
+			uring_seen(&ring);
+		}
+	}
+	uring_exit(&ring);
+	free((void *)bufs);
+	return(0);
+}
+#endif /* HAVE_URING */
+
+/*
+ * Back off while waiting on a queue, for the "spins"th time. Spin for
+ * a bit, then give the CPU away, and if it's been a while, sleep for
+ * 50us at a time.
+ */
+void
+hash_pause(int spins)
+{
+	struct timespec ts;
+
+	if (spins < 64)
+		cpu_relax();
+	else if (spins < 1024)
+		sched_yield();
+	else {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 50000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Monotonic time, in seconds.
+ */
+static double
+hash_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
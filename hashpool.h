@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A pool of threads which hash files on request, so whoever decides
+ * what needs hashing doesn't have to wait for it. Requests go in on
+ * one bounded queue, and come back (digest filled in) on another.
+ * Each worker either reads one file at a time with pread(), or keeps
+ * a number of files in flight at once through io_uring.
+ */
+#ifndef _HASHPOOL_H_
+#define _HASHPOOL_H_
+
+#include "hash.h"
+
+#define HASH_POOL_MAX		64
+#define HASH_POOL_DEPTH		64
+
+/*
+ * Read backends. The io_uring workers have up to HASH_URING_FILES
+ * files in flight each, reading HASH_URING_CHUNK bytes at a time into
+ * registered buffers.
+ */
+#define HASH_POOL_PREAD		0
+#define HASH_POOL_URING		1
+
+#define HASH_URING_FILES	16
+#define HASH_URING_CHUNK	(256 * 1024)
+
+/*
+ * A request. The digest is written to wherever "digest" points, and
+ * "error" is zero or an errno value. "arg" is for the caller.
+ */
+struct	hash_req	{
+	const char	*path;
+	unsigned char	*digest;
+	int		error;
+	void		*arg;
+};
+
+/*
+ * Time (summed over all the workers) spent with nothing to do, and
+ * spent waiting for room to hand back a result. Also how many workers
+ * actually got io_uring, if it was asked for.
+ */
+struct	hash_pool_stats	{
+	double		idle;
+	double		blocked;
+	int		uring;
+};
+
+void		hash_pool_start(int, int, int);
+int		hash_pool_submit(struct hash_req *);
+struct hash_req	*hash_pool_reap();
+void		hash_pool_stop(struct hash_pool_stats *);
+void		hash_pause(int);
+
+#endif /* _HASHPOOL_H_ */
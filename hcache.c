@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * The on-disk digest cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hcache.h"
+#include "ratelimit.h"
+
+static char			*cache_path = NULL;
+static struct hcache_header	*cache = NULL;
+static struct hcache_slot	*slots;
+static size_t			map_size;
+static struct hcache_slot	*added = NULL;
+static size_t			nadded, max_added;
+static uint64_t			run = 1;
+static uint8_t			*used = NULL;
+static struct hcache_stats	cstats;
+
+static void			hcache_put(struct hcache_header *, struct hcache_slot *);
+static struct hcache_slot	*hcache_find(struct hcache_slot *, uint64_t, struct hcache_key *);
+
+/*
+ * Fibonacci hashing on the inode, with the device mixed in.
+ */
+#define hcache_home(kp, n) \
+	((size_t)((((kp)->inode ^ ((kp)->device << 48)) * 0x9e3779b97f4a7c15ULL) >> 32) & ((n) - 1))
+
+/*
+ * Map the cache file, if there is one. A cache for some other hash
+ * algorithm (or which doesn't look right) is ignored, and will be
+ * replaced at the end.
+ */
+void
+hcache_open(const char *path)
+{
+	int fd;
+	struct stat st;
+	struct hcache_header *hp;
+
+	if ((cache_path = strdup(path)) == NULL) {
+		perror("hcache_open strdup");
+		exit(1);
+	}
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return;
+		perror(path);
+		exit(1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (st.st_size < (off_t)sizeof(struct hcache_header)) {
+		close(fd);
+		return;
+	}
+	map_size = st.st_size;
+	if ((hp = (struct hcache_header *)mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("hcache_open mmap");
+		exit(1);
+	}
+	close(fd);
+	if (memcmp(hp->magic, HCACHE_MAGIC, sizeof(HCACHE_MAGIC)) != 0 ||
+	    hp->version != HCACHE_VERSION || hp->digest_size != HASH_MAX_DIGEST ||
+	    strncmp(hp->algo, hash_algo->name, sizeof(hp->algo)) != 0 ||
+	    hp->nslots == 0 || (hp->nslots & (hp->nslots - 1)) != 0 || hp->count >= hp->nslots ||
+	    map_size != sizeof(*hp) + hp->nslots * sizeof(struct hcache_slot)) {
+		fprintf(stderr, "dupscan: ignoring hash cache %s (wrong format or algorithm).\n", path);
+		munmap((void *)hp, map_size);
+		return;
+	}
+	madvise((void *)hp, map_size, MADV_RANDOM);
+	cache = hp;
+	slots = (struct hcache_slot *)(hp + 1);
+	run = hp->run + 1;
+	if ((used = (uint8_t *)calloc((hp->nslots + 7) / 8, 1)) == NULL) {
+		perror("hcache_open calloc");
+		exit(1);
+	}
+}
+
+/*
+ * Fill in the key for a file, as it is now. Returns -1 if it can't be
+ * looked at.
+ */
+int
+hcache_key(const char *path, struct hcache_key *kp)
+{
+	struct stat st;
+
+	rate_take(RATE_OPS, 1);
+	if (stat(path, &st) < 0)
+		return(-1);
+	kp->device = st.st_dev;
+	kp->inode = st.st_ino;
+	kp->size = st.st_size;
+#ifdef __APPLE__
+	kp->mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+	kp->ctime = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+	kp->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	kp->ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+	return(0);
+}
+
+/*
+ * Look a file up. If the cache has a digest for exactly this version
+ * of it, copy the digest out, mark the entry used, and return 1.
+ */
+int
+hcache_lookup(struct hcache_key *kp, unsigned char *digest)
+{
+	struct hcache_slot *sp;
+
+	if (cache == NULL || (sp = hcache_find(slots, cache->nslots, kp)) == NULL || sp->key.size == 0 ||
+	    memcmp(&sp->key, kp, sizeof(*kp)) != 0) {
+		cstats.misses++;
+		return(0);
+	}
+	memcpy(digest, sp->digest, HASH_MAX_DIGEST);
+	__atomic_fetch_or(&used[(sp - slots) / 8], 1 << ((sp - slots) % 8), __ATOMIC_RELAXED);
+	cstats.hits++;
+	return(1);
+}
+
+/*
+ * Remember a new digest, to go in the cache at the end. A size of zero
+ * marks an empty slot, so an empty file can't go in (it's never hashed
+ * anyway).
+ */
+void
+hcache_add(struct hcache_key *kp, const unsigned char *digest)
+{
+	if (cache_path == NULL || kp->size == 0)
+		return;
+	if (nadded == max_added) {
+		max_added = max_added == 0 ? 1024 : max_added * 2;
+		if ((added = (struct hcache_slot *)realloc(added, max_added * sizeof(*added))) == NULL) {
+			perror("hcache_add realloc");
+			exit(1);
+		}
+	}
+	added[nadded].key = *kp;
+	added[nadded].run = run;
+	memcpy(added[nadded++].digest, digest, HASH_MAX_DIGEST);
+	cstats.added++;
+}
+
+/*
+ * Write out the cache, if anything was added, used or is to be dropped.
+ * The new table is built in a temporary file next to the old one, with
+ * room to spare, and then renamed over it. Entries used this run get
+ * its number, and those unused for HCACHE_KEEP runs are left out. New
+ * digests replace any older entry for the same inode.
+ */
+void
+hcache_close(struct hcache_stats *statp)
+{
+	int fd;
+	size_t i, n, nslots, size, kept;
+	char *tmp;
+	struct hcache_header *hp;
+	struct hcache_slot slot;
+
+	cstats.entries = cache != NULL ? cache->count : 0;
+	for (kept = i = 0; cache != NULL && i < cache->nslots; i++) {
+		if (slots[i].key.size == 0)
+			continue;
+		if ((used[i / 8] & (1 << (i % 8))) == 0 && run - slots[i].run >= HCACHE_KEEP)
+			cstats.dropped++;
+		else
+			kept++;
+	}
+	if (cache_path != NULL && (nadded > 0 || cstats.hits > 0 || cstats.dropped > 0)) {
+		n = kept + nadded;
+		for (nslots = HCACHE_MIN; nslots < n * 2; nslots *= 2)
+			;
+		size = sizeof(*hp) + nslots * sizeof(struct hcache_slot);
+		if ((tmp = (char *)malloc(strlen(cache_path) + 32)) == NULL) {
+			perror("hcache_close malloc");
+			exit(1);
+		}
+		sprintf(tmp, "%s.%d", cache_path, (int)getpid());
+		if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 || ftruncate(fd, size) < 0) {
+			perror(tmp);
+			exit(1);
+		}
+		if ((hp = (struct hcache_header *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			perror("hcache_close mmap");
+			exit(1);
+		}
+		memcpy(hp->magic, HCACHE_MAGIC, sizeof(HCACHE_MAGIC));
+		hp->version = HCACHE_VERSION;
+		hp->digest_size = HASH_MAX_DIGEST;
+		snprintf(hp->algo, sizeof(hp->algo), "%s", hash_algo->name);
+		hp->nslots = nslots;
+		hp->count = 0;
+		hp->run = run;
+		for (i = 0; cache != NULL && i < cache->nslots; i++) {
+			if (slots[i].key.size == 0)
+				continue;
+			slot = slots[i];
+			if ((used[i / 8] & (1 << (i % 8))) != 0)
+				slot.run = run;
+			else if (run - slot.run >= HCACHE_KEEP)
+				continue;
+			hcache_put(hp, &slot);
+		}
+		for (i = 0; i < nadded; i++)
+			hcache_put(hp, &added[i]);
+		cstats.entries = hp->count;
+		if (munmap((void *)hp, size) < 0 || close(fd) < 0 || rename(tmp, cache_path) < 0) {
+			perror(tmp);
+			exit(1);
+		}
+		free((void *)tmp);
+	}
+	if (cache != NULL)
+		munmap((void *)cache, map_size);
+	cache = NULL;
+	free((void *)used);
+	used = NULL;
+	free((void *)added);
+	added = NULL;
+	nadded = max_added = 0;
+	if (statp != NULL)
+		*statp = cstats;
+}
+
+/*
+ * Put an entry in a new table, replacing any for the same inode.
+ */
+static void
+hcache_put(struct hcache_header *hp, struct hcache_slot *sp)
+{
+	struct hcache_slot *np;
+
+	np = hcache_find((struct hcache_slot *)(hp + 1), hp->nslots, &sp->key);
+	if (np->key.size == 0)
+		hp->count++;
+	*np = *sp;
+}
+
+/*
+ * Find the slot for a key's inode in a table of "n" slots: either the
+ * one which has it, or the empty one (size zero) where it would go.
+ * A table we build is never full, but one read from a damaged file
+ * could be, despite its count, so give up after "n" tries and return
+ * NULL.
+ */
+static struct hcache_slot *
+hcache_find(struct hcache_slot *tab, uint64_t n, struct hcache_key *kp)
+{
+	size_t i, tries;
+
+	for (i = hcache_home(kp, n), tries = 0; tries < n; i = (i + 1) & (n - 1), tries++)
+		if (tab[i].key.size == 0 ||
+		    (tab[i].key.inode == kp->inode && tab[i].key.device == kp->device))
+			return(&tab[i]);
+	return(NULL);
+}
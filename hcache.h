@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A persistent cache of file digests (-C). It's a hash table in a file,
+ * keyed on device and inode, and mapped straight into memory, so a
+ * lookup is just a probe of the mapping - there's nothing to read or
+ * parse up front. An entry only counts if the file's size, mtime and
+ * ctime (to the nanosecond) are still what they were when it was
+ * hashed. New digests are held in memory, and merged into a fresh copy
+ * of the table at the end, which is renamed over the old one.
+ *
+ * Each run has a number, one more than the last, and each entry keeps
+ * the number of the last run that used it (looked it up and found it
+ * good, or added it). An entry nobody has used for HCACHE_KEEP runs is
+ * for a file that's gone or changed, and isn't copied to the new table.
+ */
+#ifndef _HCACHE_H_
+#define _HCACHE_H_
+
+#include <stdint.h>
+
+#include "hash.h"
+
+#define HCACHE_MAGIC	"dupscan"
+#define HCACHE_VERSION	2
+#define HCACHE_MIN	1024
+#define HCACHE_KEEP	10
+
+/*
+ * What identifies a version of a file.
+ */
+struct	hcache_key	{
+	uint64_t	device;
+	uint64_t	inode;
+	uint64_t	size;
+	int64_t		mtime;
+	int64_t		ctime;
+};
+
+/*
+ * The file is a header, then a power-of-two number of slots. A slot
+ * with a size of zero is empty (empty files are never hashed).
+ */
+struct	hcache_header	{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	digest_size;
+	char		algo[16];
+	uint64_t	nslots;
+	uint64_t	count;
+	uint64_t	run;
+	char		pad[8];
+};
+
+struct	hcache_slot	{
+	struct hcache_key	key;
+	uint64_t		run;
+	unsigned char		digest[HASH_MAX_DIGEST];
+};
+
+struct	hcache_stats	{
+	long		hits;
+	long		misses;
+	long		added;
+	long		dropped;
+	uint64_t	entries;
+};
+
+void	hcache_open(const char *);
+int	hcache_key(const char *, struct hcache_key *);
+int	hcache_lookup(struct hcache_key *, unsigned char *);
+void	hcache_add(struct hcache_key *, const unsigned char *);
+void	hcache_close(struct hcache_stats *);
+
+#endif /* _HCACHE_H_ */
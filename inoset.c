@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Open-addressing hash set of (device, inode) pairs, with linear
+ * probing. Nothing is ever removed, so there's no need for anything
+ * cleverer, and the table doubles when it's three-quarters full.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "inoset.h"
+
+#define INOSET_MIN_SLOTS	256
+
+static struct inoset_slot	*inoset_alloc(size_t);
+static void			inoset_grow(struct inoset *);
+
+/*
+ * Fibonacci hashing, as for the size index. Inode numbers are often
+ * dense, so this spreads them out nicely.
+ */
+#define inoset_home(sp, dev, ino) \
+	((size_t)((((ino) ^ ((uint64_t)(dev) << 48)) * 0x9e3779b97f4a7c15ULL) >> (sp)->shift))
+
+/*
+ * Set up an empty set.
+ */
+void
+inoset_init(struct inoset *sp)
+{
+	sp->slots = inoset_alloc(INOSET_MIN_SLOTS);
+	sp->mask = INOSET_MIN_SLOTS - 1;
+	sp->shift = 64 - 8;
+	sp->count = 0;
+}
+
+/*
+ * Release the table.
+ */
+void
+inoset_free(struct inoset *sp)
+{
+	free((void *)sp->slots);
+	sp->slots = NULL;
+	sp->mask = sp->count = 0;
+}
+
+/*
+ * Find the value for an inode, adding it (with a value of INOSET_EMPTY)
+ * if it isn't there already. The caller should set the value of a new
+ * inode to something else. The pointer is only good until the next
+ * insertion.
+ */
+uint32_t *
+inoset_insert(struct inoset *sp, uint32_t dev, uint64_t ino)
+{
+	size_t i;
+	struct inoset_slot *p;
+
+	if ((sp->count + 1) * 4 > (sp->mask + 1) * 3)
+		inoset_grow(sp);
+	for (i = inoset_home(sp, dev, ino);; i = (i + 1) & sp->mask) {
+		p = &sp->slots[i];
+		if (p->value == INOSET_EMPTY) {
+			p->inode = ino;
+			p->device = dev;
+			sp->count++;
+			return(&p->value);
+		}
+		if (p->inode == ino && p->device == dev)
+			return(&p->value);
+	}
+}
+
+/*
+ * Double the size of the table, and re-insert everything.
+ */
+static void
+inoset_grow(struct inoset *sp)
+{
+	size_t i, nslots;
+	struct inoset_slot *old;
+
+	old = sp->slots;
+	nslots = sp->mask + 1;
+	sp->slots = inoset_alloc(nslots * 2);
+	sp->mask = nslots * 2 - 1;
+	sp->shift--;
+	sp->count = 0;
+	for (i = 0; i < nslots; i++)
+		if (old[i].value != INOSET_EMPTY)
+			*inoset_insert(sp, old[i].device, old[i].inode) = old[i].value;
+	free((void *)old);
+}
+
+/*
+ * Allocate a table of empty slots.
+ */
+static struct inoset_slot *
+inoset_alloc(size_t nslots)
+{
+	size_t i;
+	struct inoset_slot *p;
+
+	if ((p = (struct inoset_slot *)malloc(nslots * sizeof(struct inoset_slot))) == NULL) {
+		perror("inoset_alloc malloc");
+		exit(1);
+	}
+	for (i = 0; i < nslots; i++) {
+		p[i].inode = 0;
+		p[i].device = 0;
+		p[i].value = INOSET_EMPTY;
+	}
+	return(p);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A set of inodes, keyed on device and inode number, each with a
+ * 32-bit value. It only ever holds files with more than one link, so
+ * it stays small, and a second link to one of them can be spotted
+ * without opening anything.
+ */
+#ifndef _INOSET_H_
+#define _INOSET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A slot. Sixteen bytes, with the device as a small index rather than
+ * a dev_t. Empty slots have a value of INOSET_EMPTY.
+ */
+#define INOSET_EMPTY	(~(uint32_t)0)
+
+struct	inoset_slot	{
+	uint64_t	inode;
+	uint32_t	device;
+	uint32_t	value;
+};
+
+struct	inoset	{
+	struct inoset_slot	*slots;
+	size_t			mask;
+	size_t			count;
+	int			shift;
+};
+
+void		inoset_init(struct inoset *);
+void		inoset_free(struct inoset *);
+uint32_t	*inoset_insert(struct inoset *, uint32_t, uint64_t);
+
+#endif /* _INOSET_H_ */
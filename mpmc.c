@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Bounded MPMC queue. A cell at position "pos" can be written when its
+ * sequence number is "pos", and read when it's "pos + 1". The reader
+ * then bumps it a full lap on, to "pos + size", ready for the next
+ * writer. Neither side ever waits - a full or empty queue is reported,
+ * and it's up to the caller what to do about it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mpmc.h"
+
+/*
+ * Set up a queue with room for at least "size" pointers. The size is
+ * rounded up to a power of two.
+ */
+void
+mpmc_init(struct mpmc_queue *qp, size_t size)
+{
+	size_t i, n;
+
+	for (n = 2; n < size; n *= 2)
+		;
+	if ((qp->cells = (struct mpmc_cell *)malloc(n * sizeof(struct mpmc_cell))) == NULL) {
+		perror("mpmc_init malloc");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		qp->cells[i].seq = i;
+	qp->mask = n - 1;
+	qp->head = qp->tail = 0;
+}
+
+/*
+ * Release the queue. Anything still in it is forgotten about.
+ */
+void
+mpmc_free(struct mpmc_queue *qp)
+{
+	free((void *)qp->cells);
+	qp->cells = NULL;
+}
+
+/*
+ * Add a pointer to the queue. Returns zero if the queue is full.
+ */
+int
+mpmc_push(struct mpmc_queue *qp, void *data)
+{
+	size_t pos, seq;
+	intptr_t diff;
+	struct mpmc_cell *cp;
+
+	pos = __atomic_load_n(&qp->head, __ATOMIC_RELAXED);
+	for (;;) {
+		cp = &qp->cells[pos & qp->mask];
+		seq = __atomic_load_n(&cp->seq, __ATOMIC_ACQUIRE);
+		if ((diff = (intptr_t)seq - (intptr_t)pos) == 0) {
+			if (__atomic_compare_exchange_n(&qp->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0)
+			return(0);
+		else
+			pos = __atomic_load_n(&qp->head, __ATOMIC_RELAXED);
+	}
+	cp->data = data;
+	__atomic_store_n(&cp->seq, pos + 1, __ATOMIC_RELEASE);
+	return(1);
+}
+
+/*
+ * Take the oldest pointer off the queue. Returns zero if the queue is
+ * empty.
+ */
+int
+mpmc_pop(struct mpmc_queue *qp, void **datap)
+{
+	size_t pos, seq;
+	intptr_t diff;
+	struct mpmc_cell *cp;
+
+	pos = __atomic_load_n(&qp->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		cp = &qp->cells[pos & qp->mask];
+		seq = __atomic_load_n(&cp->seq, __ATOMIC_ACQUIRE);
+		if ((diff = (intptr_t)seq - (intptr_t)(pos + 1)) == 0) {
+			if (__atomic_compare_exchange_n(&qp->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0)
+			return(0);
+		else
+			pos = __atomic_load_n(&qp->tail, __ATOMIC_RELAXED);
+	}
+	*datap = cp->data;
+	__atomic_store_n(&cp->seq, pos + qp->mask + 1, __ATOMIC_RELEASE);
+	return(1);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Bounded lock-free multi-producer/multi-consumer queue of pointers
+ * (Dmitry Vyukov's design). Each cell carries a sequence number which
+ * says whether it's ready to be written or read on the current lap,
+ * so producers and consumers only contend on their own index.
+ */
+#ifndef _MPMC_H_
+#define _MPMC_H_
+
+#include <stddef.h>
+
+struct	mpmc_cell	{
+	size_t		seq;
+	void		*data;
+};
+
+struct	mpmc_queue	{
+	struct mpmc_cell	*cells;
+	size_t			mask;
+	size_t			head __attribute__((aligned(64)));
+	size_t			tail __attribute__((aligned(64)));
+};
+
+void	mpmc_init(struct mpmc_queue *, size_t);
+void	mpmc_free(struct mpmc_queue *);
+int	mpmc_push(struct mpmc_queue *, void *);
+int	mpmc_pop(struct mpmc_queue *, void **);
+
+#endif /* _MPMC_H_ */
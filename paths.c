@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Directory nodes and names, in per-thread bump arenas. Allocation is
+ * just a pointer increment, and a new 1 MiB chunk is grabbed whenever
+ * the current one runs out. Nothing is ever given back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "paths.h"
+
+struct	arena	{
+	char		*next;
+	size_t		left;
+	size_t		total;
+} __attribute__((aligned(64)));
+
+static struct arena	arenas[PATH_ARENAS];
+
+static void	*arena_alloc(struct arena *, size_t, size_t);
+
+/*
+ * Add a directory node for "name" under "parent" (NULL for the top of
+ * the tree, in which case the name can be a whole path).
+ */
+struct dirnode *
+path_dir(int tid, struct dirnode *parent, const char *name)
+{
+	struct dirnode *dp;
+
+	dp = (struct dirnode *)arena_alloc(&arenas[tid], sizeof(struct dirnode), sizeof(void *));
+	dp->parent = parent;
+	dp->name = path_name(tid, name);
+	return(dp);
+}
+
+/*
+ * Keep a copy of a name.
+ */
+const char *
+path_name(int tid, const char *name)
+{
+	char *cp;
+	size_t len;
+
+	len = strlen(name) + 1;
+	cp = (char *)arena_alloc(&arenas[tid], len, 1);
+	memcpy(cp, name, len);
+	return(cp);
+}
+
+/*
+ * Put the full path back together in "buf" (PATH_MAX bytes). The name
+ * can be NULL for the path of the directory itself. A path which won't
+ * fit couldn't be opened anyway, so that's fatal.
+ */
+char *
+path_build(struct dirnode *dp, const char *name, char *buf)
+{
+	size_t len, n;
+	struct dirnode *p;
+
+	len = name != NULL ? strlen(name) + 1 : 0;
+	for (p = dp; p != NULL; p = p->parent)
+		len += strlen(p->name) + (p->parent != NULL);
+	if (len >= PATH_MAX) {
+		fprintf(stderr, "Path too long under %s.\n", dp->name);
+		exit(1);
+	}
+	buf[len] = '\0';
+	if (name != NULL) {
+		n = strlen(name);
+		len -= n;
+		memcpy(buf + len, name, n);
+		buf[--len] = '/';
+	}
+	for (p = dp; p != NULL; p = p->parent) {
+		n = strlen(p->name);
+		len -= n;
+		memcpy(buf + len, p->name, n);
+		if (p->parent != NULL)
+			buf[--len] = '/';
+	}
+	return(buf);
+}
+
+/*
+ * How much memory the arenas have taken, all told.
+ */
+size_t
+path_memory()
+{
+	int i;
+	size_t total;
+
+	for (total = 0, i = 0; i < PATH_ARENAS; i++)
+		total += arenas[i].total;
+	return(total);
+}
+
+/*
+ * Carve "size" bytes, aligned to "align", out of an arena.
+ */
+static void *
+arena_alloc(struct arena *ap, size_t size, size_t align)
+{
+	size_t pad;
+	void *p;
+
+	pad = (align - ((size_t)ap->next & (align - 1))) & (align - 1);
+	if (ap->next == NULL || pad + size > ap->left) {
+		if ((ap->next = (char *)malloc(PATH_CHUNK)) == NULL) {
+			perror("arena_alloc malloc");
+			exit(1);
+		}
+		ap->left = PATH_CHUNK;
+		ap->total += PATH_CHUNK;
+		pad = 0;
+	}
+	p = ap->next + pad;
+	ap->next += pad + size;
+	ap->left -= pad + size;
+	return(p);
+}
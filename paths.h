@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Compact path storage. Rather than a full path for every file, keep
+ * a node for each directory (its name, and a pointer to its parent)
+ * and just the file's own name. Names and nodes are carved out of
+ * large arena chunks and never freed, so there's no per-string malloc
+ * overhead either. The full path is only put back together when it's
+ * needed to open or print something.
+ */
+#ifndef _PATHS_H_
+#define _PATHS_H_
+
+#include <stddef.h>
+#include <limits.h>
+
+/*
+ * One arena per thread which might be adding paths (the scan threads),
+ * so they never have to lock.
+ */
+#define PATH_ARENAS	64
+#define PATH_CHUNK	(1024 * 1024)
+
+#ifndef PATH_MAX
+#  define PATH_MAX	4096
+#endif
+
+struct	dirnode	{
+	struct dirnode	*parent;
+	const char	*name;
+};
+
+/*
+ * Where a file is: its directory's node, and its own name.
+ */
+struct	pathref	{
+	struct dirnode	*dir;
+	const char	*name;
+};
+
+struct dirnode	*path_dir(int, struct dirnode *, const char *);
+const char	*path_name(int, const char *);
+char		*path_build(struct dirnode *, const char *, char *);
+size_t		path_memory();
+
+#endif /* _PATHS_H_ */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Token-bucket rate limits on reading and metadata operations (see
+ * ratelimit.h).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+#include "ratelimit.h"
+
+/*
+ * The idle I/O class, for ioprio_set(2). There's no glibc wrapper, or
+ * header, for any of it.
+ */
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_CLASS_SHIFT	13
+
+struct rate	rates[RATE_NLIMITS];
+int		rate_reload = 0;
+
+static char	*rate_path = NULL;
+static int	rate_locked = 0;
+
+static void	rate_hup(int);
+static int	rate_fail(const char *);
+static int64_t	rate_now();
+
+/*
+ * A size or a rate, from the command line or the control file: a
+ * number of bytes (or operations), with an optional K, M or G (powers
+ * of 1024). Returns -1 if it doesn't make sense, or won't fit.
+ */
+int64_t
+size_arg(const char *str)
+{
+	int64_t n, scale;
+	char *cp;
+
+	errno = 0;
+	if ((n = strtoll(str, &cp, 10)) < 0 || cp == str || errno == ERANGE)
+		return(-1);
+	switch (*cp) {
+	case 'G': case 'g':
+		scale = 1024LL * 1024 * 1024;
+		cp++;
+		break;
+	case 'M': case 'm':
+		scale = 1024LL * 1024;
+		cp++;
+		break;
+	case 'K': case 'k':
+		scale = 1024;
+		cp++;
+		break;
+	default:
+		scale = 1;
+	}
+	if (*cp != '\0' || n > INT64_MAX / scale)
+		return(-1);
+	return(n * scale);
+}
+
+/*
+ * Set a limit (zero for none). A bucket starts off full.
+ */
+void
+rate_set(int which, int64_t limit)
+{
+	__atomic_store_n(&rates[which].next, rate_now() - RATE_BURST, __ATOMIC_RELAXED);
+	__atomic_store_n(&rates[which].limit, limit, __ATOMIC_RELAXED);
+}
+
+/*
+ * Read the limits from a control file. The first time through, this
+ * remembers the file and has SIGHUP read it again. After that, it's
+ * called with NULL (by whichever thread notices the signal first) to
+ * do the reading. Each line is "read" or "ops" and a rate, and blank
+ * lines and anything after a "#" are ignored. Anything that isn't in
+ * the file has no limit. Returns -1 if the file can't be read or
+ * doesn't make sense, and the limits are left as they were (which, on
+ * a reload, we say).
+ */
+int
+rate_file(const char *path)
+{
+	int line, which;
+	int64_t n, limits[RATE_NLIMITS];
+	char buf[256], *cp, *name, *value;
+	FILE *fp;
+
+	if (path != NULL) {
+		if ((rate_path = strdup(path)) == NULL) {
+			perror("rate_file strdup");
+			exit(1);
+		}
+		signal(SIGHUP, rate_hup);
+	} else if (__atomic_exchange_n(&rate_locked, 1, __ATOMIC_ACQUIRE))
+		return(0);
+	__atomic_store_n(&rate_reload, 0, __ATOMIC_RELAXED);
+	memset(limits, 0, sizeof(limits));
+	if ((fp = fopen(rate_path, "r")) == NULL) {
+		perror(rate_path);
+		return(rate_fail(path));
+	}
+	for (line = 1; fgets(buf, sizeof(buf), fp) != NULL; line++) {
+		if ((cp = strchr(buf, '#')) != NULL)
+			*cp = '\0';
+		if ((name = strtok(buf, " \t\n")) == NULL)
+			continue;
+		value = strtok(NULL, " \t\n");
+		if (strcmp(name, "read") == 0)
+			which = RATE_READ;
+		else if (strcmp(name, "ops") == 0)
+			which = RATE_OPS;
+		else
+			which = -1;
+		if (which < 0 || value == NULL || (n = size_arg(value)) < 0 || strtok(NULL, " \t\n") != NULL) {
+			fprintf(stderr, "%s, line %d: expected \"read\" or \"ops\" and a rate.\n", rate_path, line);
+			fclose(fp);
+			return(rate_fail(path));
+		}
+		limits[which] = n;
+	}
+	fclose(fp);
+	for (which = 0; which < RATE_NLIMITS; which++)
+		if (limits[which] != __atomic_load_n(&rates[which].limit, __ATOMIC_RELAXED))
+			rate_set(which, limits[which]);
+	__atomic_store_n(&rate_locked, 0, __ATOMIC_RELEASE);
+	return(0);
+}
+
+/*
+ * Drop to the idle I/O class. Threads started after this inherit it.
+ * It's only a hint, so if the kernel won't have it, never mind.
+ */
+void
+rate_idle()
+{
+#ifdef SYS_ioprio_set
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+/*
+ * Take "n" from a bucket with a limit, and sleep if we're ahead of it.
+ * The bucket is empty at "next", and "n" more pushes that out by the
+ * time it takes to earn them. Up to RATE_BURST ahead of now is free.
+ */
+void
+rate_wait(struct rate *rp, int64_t n)
+{
+	int64_t t, next, when, limit, wait;
+	struct timespec ts;
+
+	if ((limit = __atomic_load_n(&rp->limit, __ATOMIC_RELAXED)) <= 0)
+		return;
+	t = rate_now();
+	next = __atomic_load_n(&rp->next, __ATOMIC_RELAXED);
+	do {
+		when = next > t - RATE_BURST ? next : t - RATE_BURST;
+		when += (int64_t)((double)n * 1e9 / limit);
+	} while (!__atomic_compare_exchange_n(&rp->next, &next, when, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	if ((wait = when - t) <= 0)
+		return;
+	__atomic_add_fetch(&rp->waited, wait, __ATOMIC_RELAXED);
+	ts.tv_sec = wait / 1000000000LL;
+	ts.tv_nsec = wait % 1000000000LL;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * SIGHUP: read the control file again, next time anyone takes from a
+ * bucket.
+ */
+static void
+rate_hup(int sig)
+{
+	(void)sig;
+	__atomic_store_n(&rate_reload, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The control file was no good. If this was a reload, say that the
+ * old limits still stand, so whoever edited it knows.
+ */
+static int
+rate_fail(const char *path)
+{
+	if (path == NULL)
+		fprintf(stderr, "dupscan: %s: keeping the previous limits.\n", rate_path);
+	__atomic_store_n(&rate_locked, 0, __ATOMIC_RELEASE);
+	return(-1);
+}
+
+/*
+ * Monotonic time, in nanoseconds.
+ */
+static int64_t
+rate_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Rate limits on what a scan can do to the disk: bytes read per
+ * second, and metadata operations (opens, stats and directory reads)
+ * per second. Each is a token bucket, kept as the time at which the
+ * bucket would next be empty (the "generic cell rate algorithm"), so
+ * taking from it is one compare-and-swap and any thread can do it.
+ * A thread that's ahead of the rate sleeps it off.
+ *
+ * The limits can be read from a control file, which is read again
+ * whenever we get a SIGHUP, so a long scan can be slowed down or sped
+ * up without starting over. Whenever there's a limit, the process
+ * also drops to the idle I/O class, so the disk goes to anyone else
+ * first.
+ */
+#ifndef _RATELIMIT_H_
+#define _RATELIMIT_H_
+
+#include <stdint.h>
+
+#define RATE_READ	0
+#define RATE_OPS	1
+#define RATE_NLIMITS	2
+
+/*
+ * How far a bucket can get ahead (in nanoseconds), so a quiet spell
+ * doesn't have to be paid for straight away.
+ */
+#define RATE_BURST	100000000LL
+
+struct	rate	{
+	int64_t		limit;		/* per second, zero for none */
+	int64_t		next;		/* when the bucket is next empty */
+	int64_t		waited;		/* nanoseconds spent asleep */
+} __attribute__((aligned(64)));
+
+extern struct rate	rates[RATE_NLIMITS];
+extern int		rate_reload;
+
+int64_t	size_arg(const char *);
+void	rate_set(int, int64_t);
+int	rate_file(const char *);
+void	rate_idle();
+void	rate_wait(struct rate *, int64_t);
+
+/*
+ * Take "n" from a bucket. This is everywhere the disk gets used, so
+ * when there's no limit it's just a load and a test.
+ */
+static inline void
+rate_take(int which, int64_t n)
+{
+	if (__atomic_load_n(&rate_reload, __ATOMIC_RELAXED))
+		rate_file(NULL);
+	if (__atomic_load_n(&rates[which].limit, __ATOMIC_RELAXED) > 0)
+		rate_wait(&rates[which], n);
+}
+
+#endif /* _RATELIMIT_H_ */
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Hard-link replacement of duplicates, batched by directory, and
+ * extent sharing, batched by original.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#endif
+
+#include "replace.h"
+
+/*
+ * A duplicate to be replaced. Keep what it and its original looked
+ * like when we scanned them, so we can tell if either has changed since.
+ */
+struct	replacement	{
+	struct pathref	dup;
+	struct pathref	orig;
+	struct replace_file	dfile;
+	struct replace_file	ofile;
+	uint32_t	nlinks;
+	uint32_t	seq;
+};
+
+static struct replacement	*reps = NULL;
+static size_t			nreps, max_reps;
+static size_t			*batches;
+static size_t			nbatches;
+static size_t			next_batch;
+static int			action, dry_run, chatty;
+
+struct	replace_worker	{
+	pthread_t		thread;
+	struct replace_stats	stats;
+} __attribute__((aligned(64)));
+
+static void	*replace_worker(void *);
+static void	replace_batch(size_t, size_t, struct replace_stats *);
+static void	replace_dir(size_t, size_t, struct replace_stats *);
+static int	replace_one(int, struct replacement *, char *, char *);
+static void	dedupe_orig(size_t, size_t, struct replace_stats *);
+static void	dedupe_some(int, size_t, int, struct replace_stats *);
+static int	dedupe_open(struct replacement *);
+static int	rep_check(struct stat *, struct replace_file *, int);
+static int	rep_cmp(const void *, const void *);
+static int	rep_same(struct replacement *, struct replacement *);
+static double	replace_now();
+
+/*
+ * Queue up a duplicate, to be replaced with a link to the original.
+ * Both files are as the scan found them, and the link count is the
+ * duplicate's.
+ */
+void
+replace_add(struct pathref *dup, struct replace_file *dfp, struct pathref *orig,
+		struct replace_file *ofp, uint32_t nlinks)
+{
+	struct replacement *rp;
+
+	if (nreps == max_reps) {
+		max_reps = max_reps == 0 ? 1024 : max_reps * 2;
+		if ((reps = (struct replacement *)realloc(reps, max_reps * sizeof(*reps))) == NULL) {
+			perror("replace_add realloc");
+			exit(1);
+		}
+	}
+	rp = &reps[nreps];
+	rp->dup = *dup;
+	rp->orig = *orig;
+	rp->dfile = *dfp;
+	rp->ofile = *ofp;
+	rp->nlinks = nlinks;
+	rp->seq = nreps++;
+}
+
+/*
+ * Deal with everything queued up, by "mode" (REPLACE_LINK or
+ * REPLACE_DEDUPE), with "nthreads" threads. With "dryrun" set, nothing
+ * is touched, and the stats are what would have happened. The queue is
+ * sorted so each directory's files (or each original's duplicates) are
+ * together, and each of those is a batch for one thread.
+ */
+void
+replace_run(int mode, int nthreads, int dryrun, int verbose, struct replace_stats *sp)
+{
+	int i;
+	size_t n;
+	struct replace_worker *workers;
+
+	memset(sp, 0, sizeof(*sp));
+	sp->elapsed = replace_now();
+	action = mode;
+	dry_run = dryrun;
+	chatty = verbose;
+	qsort(reps, nreps, sizeof(*reps), rep_cmp);
+	if ((batches = (size_t *)malloc((nreps + 1) * sizeof(size_t))) == NULL) {
+		perror("replace_run malloc");
+		exit(1);
+	}
+	for (nbatches = 0, n = 0; n < nreps; n++)
+		if (n == 0 || !rep_same(&reps[n], &reps[n - 1]))
+			batches[nbatches++] = n;
+	batches[nbatches] = nreps;
+	next_batch = 0;
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > REPLACE_MAX_THREADS)
+		nthreads = REPLACE_MAX_THREADS;
+	if (dry_run || nthreads == 1 || nbatches < 2) {
+		for (n = 0; n < nbatches; n++)
+			replace_batch(batches[n], batches[n + 1], sp);
+	} else {
+		if ((workers = (struct replace_worker *)calloc(nthreads, sizeof(*workers))) == NULL) {
+			perror("replace_run calloc");
+			exit(1);
+		}
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&workers[i].thread, NULL, replace_worker, &workers[i]) != 0) {
+				perror("replace_run pthread_create");
+				exit(1);
+			}
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(workers[i].thread, NULL);
+			sp->files += workers[i].stats.files;
+			sp->failed += workers[i].stats.failed;
+			sp->differ += workers[i].stats.differ;
+			sp->bytes += workers[i].stats.bytes;
+			sp->reclaimed += workers[i].stats.reclaimed;
+		}
+		free((void *)workers);
+	}
+	free((void *)batches);
+	free((void *)reps);
+	reps = NULL;
+	nreps = max_reps = 0;
+	sp->elapsed = replace_now() - sp->elapsed;
+}
+
+/*
+ * A worker just takes the next batch until there are none left.
+ */
+static void *
+replace_worker(void *arg)
+{
+	size_t b;
+	struct replace_worker *wp = (struct replace_worker *)arg;
+
+	while ((b = __atomic_fetch_add(&next_batch, 1, __ATOMIC_RELAXED)) < nbatches)
+		replace_batch(batches[b], batches[b + 1], &wp->stats);
+	return(NULL);
+}
+
+/*
+ * Deal with one batch, whichever way we're doing it.
+ */
+static void
+replace_batch(size_t from, size_t to, struct replace_stats *sp)
+{
+	if (action == REPLACE_DEDUPE)
+		dedupe_orig(from, to, sp);
+	else
+		replace_dir(from, to, sp);
+}
+
+/*
+ * Replace queue entries "from" to "to"-1, which are all in the same
+ * directory.
+ */
+static void
+replace_dir(size_t from, size_t to, struct replace_stats *sp)
+{
+	int dfd;
+	size_t i;
+	char dbuf[PATH_MAX], obuf[PATH_MAX], tmp[64];
+
+	path_build(reps[from].dup.dir, NULL, dbuf);
+	if (dry_run)
+		dfd = -1;
+	else if ((dfd = open(dbuf, O_RDONLY | O_DIRECTORY)) < 0) {
+		fprintf(stderr, "Can't open %s: %s\n", dbuf, strerror(errno));
+		sp->failed += to - from;
+		return;
+	}
+	for (i = from; i < to; i++) {
+		path_build(reps[i].orig.dir, reps[i].orig.name, obuf);
+		snprintf(tmp, sizeof(tmp), ".dupscan.%d.%u", (int)getpid(), reps[i].seq);
+		if (replace_one(dfd, &reps[i], obuf, tmp) < 0) {
+			fprintf(stderr, "Can't replace %s/%s with a link to %s: %s\n",
+					dbuf, reps[i].dup.name, obuf, strerror(errno));
+			sp->failed++;
+			continue;
+		}
+		if (chatty)
+			printf("%s %s/%s with a link to %s.\n", dry_run ? "Would replace" : "Replaced",
+					dbuf, reps[i].dup.name, obuf);
+		sp->files++;
+		sp->bytes += reps[i].dfile.size;
+		if (reps[i].nlinks <= 1)
+			sp->reclaimed += reps[i].dfile.size;
+	}
+	if (dfd >= 0)
+		close(dfd);
+}
+
+/*
+ * Swap one duplicate for a link to "orig". First make sure both it and
+ * the original are still the files we looked at, since either could
+ * have been written to (without changing size) since they were found
+ * to be the same. Then link the original in under the temporary name,
+ * and rename that over the duplicate. If the rename fails, the
+ * temporary link is removed again. Returns -1 (with errno set) if
+ * anything goes wrong, in which case the duplicate is untouched.
+ */
+static int
+replace_one(int dfd, struct replacement *rp, char *orig, char *tmp)
+{
+	int err;
+	struct stat st;
+
+	if (dfd < 0)
+		return(0);
+	if (fstatat(dfd, rp->dup.name, &st, AT_SYMLINK_NOFOLLOW) < 0 || rep_check(&st, &rp->dfile, 0) < 0)
+		return(-1);
+	if (fstatat(AT_FDCWD, orig, &st, AT_SYMLINK_NOFOLLOW) < 0 || rep_check(&st, &rp->ofile, 1) < 0)
+		return(-1);
+	if (linkat(AT_FDCWD, orig, dfd, tmp, 0) < 0)
+		return(-1);
+	if (renameat(dfd, tmp, dfd, rp->dup.name) < 0) {
+		err = errno;
+		unlinkat(dfd, tmp, 0);
+		errno = err;
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Share extents between the original and its duplicates, queue entries
+ * "from" to "to"-1. The original is opened once, and its duplicates
+ * are taken DEDUPE_DESTS at a time.
+ */
+static void
+dedupe_orig(size_t from, size_t to, struct replace_stats *sp)
+{
+	int sfd, n;
+	size_t i;
+	char buf[PATH_MAX];
+	struct stat st;
+
+	path_build(reps[from].orig.dir, reps[from].orig.name, buf);
+	if (dry_run)
+		sfd = -1;
+	else if ((sfd = open(buf, O_RDONLY)) < 0 || fstat(sfd, &st) < 0 ||
+	    rep_check(&st, &reps[from].ofile, 1) < 0) {
+		fprintf(stderr, "Can't open %s: %s\n", buf, strerror(errno));
+		if (sfd >= 0)
+			close(sfd);
+		sp->failed += to - from;
+		return;
+	}
+	for (i = from; i < to; i += n) {
+		n = to - i < DEDUPE_DESTS ? to - i : DEDUPE_DESTS;
+		dedupe_some(sfd, i, n, sp);
+	}
+	if (sfd >= 0)
+		close(sfd);
+}
+
+/*
+ * Share the extents of "n" duplicates, starting at queue entry "first",
+ * with the original (open on "sfd"). Each ioctl asks for DEDUPE_CHUNK
+ * bytes of all of them, and any the kernel says differ, or which fail,
+ * are dropped from the rest. The kernel might share less than it was
+ * asked to (and not the same for each), so the next ioctl starts after
+ * the least any of them got, and the rest is asked for again. One which
+ * gets nothing shared at all is given up on.
+ */
+static void
+dedupe_some(int sfd, size_t first, int n, struct replace_stats *sp)
+{
+	int i, fds[DEDUPE_DESTS];
+	uint64_t size = reps[first].dfile.size;
+	char buf[PATH_MAX];
+#ifdef FIDEDUPERANGE
+	int k, err;
+	uint64_t off, len, done;
+	struct replacement *rp;
+	struct file_dedupe_range *dp;
+	struct file_dedupe_range_info *ip;
+	union {
+		struct file_dedupe_range	hdr;
+		char				space[sizeof(struct file_dedupe_range) +
+						      DEDUPE_DESTS * sizeof(struct file_dedupe_range_info)];
+	} arg;
+#endif
+
+	for (i = 0; i < n; i++) {
+		if (dry_run) {
+			fds[i] = -1;
+			sp->files++;
+			sp->bytes += size;
+			sp->reclaimed += size;
+		} else if ((fds[i] = dedupe_open(&reps[first + i])) < 0) {
+			path_build(reps[first + i].dup.dir, reps[first + i].dup.name, buf);
+			fprintf(stderr, "Can't open %s: %s\n", buf, strerror(errno));
+			sp->failed++;
+		}
+	}
+	if (dry_run)
+		return;
+#ifdef FIDEDUPERANGE
+	dp = &arg.hdr;
+	for (off = 0; off < size; off += len) {
+		len = size - off < DEDUPE_CHUNK ? size - off : DEDUPE_CHUNK;
+		memset(&arg, 0, sizeof(arg));
+		dp->src_offset = off;
+		dp->src_length = len;
+		for (k = i = 0; i < n; i++) {
+			if (fds[i] < 0)
+				continue;
+			dp->info[k].dest_fd = fds[i];
+			dp->info[k++].dest_offset = off;
+		}
+		if ((dp->dest_count = k) == 0)
+			break;
+		if (ioctl(sfd, FIDEDUPERANGE, dp) < 0)
+			for (err = errno, k = 0; k < dp->dest_count; k++)
+				dp->info[k].status = -err;
+		for (done = len, ip = dp->info, i = 0; i < n; i++) {
+			if (fds[i] < 0)
+				continue;
+			rp = &reps[first + i];
+			if (ip->status == FILE_DEDUPE_RANGE_DIFFERS || ip->status < 0) {
+				sp->reclaimed += ip->bytes_deduped;
+				path_build(rp->dup.dir, rp->dup.name, buf);
+				if (ip->status < 0) {
+					fprintf(stderr, "Can't share extents of %s: %s\n", buf, strerror(-ip->status));
+					sp->failed++;
+				} else {
+					fprintf(stderr, "Kernel says %s differs from its original.\n", buf);
+					sp->differ++;
+				}
+				close(fds[i]);
+				fds[i] = -1;
+			} else if (ip->bytes_deduped < done)
+				done = ip->bytes_deduped;
+			ip++;
+		}
+		/*
+		 * Those still going had at least "done" bytes shared. Anything
+		 * past that, for any of them, is asked for again next time.
+		 */
+		for (i = 0; i < n; i++) {
+			if (fds[i] < 0)
+				continue;
+			if (done > 0) {
+				sp->reclaimed += done;
+				continue;
+			}
+			path_build(reps[first + i].dup.dir, reps[first + i].dup.name, buf);
+			fprintf(stderr, "Can't share extents of %s: kernel shared nothing at offset %llu\n",
+					buf, (unsigned long long)off);
+			sp->failed++;
+			close(fds[i]);
+			fds[i] = -1;
+		}
+		len = done;
+	}
+	for (i = 0; i < n; i++) {
+		if (fds[i] < 0)
+			continue;
+		close(fds[i]);
+		sp->files++;
+		sp->bytes += size;
+		if (chatty) {
+			rp = &reps[first + i];
+			printf("Shared extents of %s ", path_build(rp->dup.dir, rp->dup.name, buf));
+			printf("with %s.\n", path_build(rp->orig.dir, rp->orig.name, buf));
+		}
+	}
+#else
+	for (i = 0; i < n; i++) {
+		if (fds[i] < 0)
+			continue;
+		close(fds[i]);
+		path_build(reps[first + i].dup.dir, reps[first + i].dup.name, buf);
+		fprintf(stderr, "Can't share extents of %s: not supported here\n", buf);
+		sp->failed++;
+	}
+#endif
+}
+
+/*
+ * Open a duplicate for FIDEDUPERANGE, and make sure it's still the file
+ * we looked at, as for -L. The kernel compares the data anyway, but a
+ * file which has changed is left alone either way. The kernel wants it
+ * open for writing, unless we own it (or are root), so try that first.
+ */
+static int
+dedupe_open(struct replacement *rp)
+{
+	int fd;
+	struct stat st;
+	char buf[PATH_MAX];
+
+	path_build(rp->dup.dir, rp->dup.name, buf);
+	if ((fd = open(buf, O_RDWR)) < 0 && (fd = open(buf, O_RDONLY)) < 0)
+		return(-1);
+	if (fstat(fd, &st) < 0 || rep_check(&st, &rp->dfile, 0) < 0) {
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+/*
+ * Is a file (as it is now, in "sp") still the one we scanned? If not,
+ * returns -1 with errno set to ESTALE. Each link we make to an original
+ * changes its ctime, so for an "orig" only the mtime is checked, which
+ * is enough to catch it being written to.
+ */
+static int
+rep_check(struct stat *sp, struct replace_file *fp, int orig)
+{
+	if (!S_ISREG(sp->st_mode) || (uint64_t)sp->st_ino != fp->inode || (uint64_t)sp->st_size != fp->size ||
+	    ST_MTIME(sp) != fp->mtime || (!orig && ST_CTIME(sp) != fp->ctime)) {
+		errno = ESTALE;
+		return(-1);
+	}
+	return(0);
+}
+
+/*
+ * Are two queue entries in the same batch? For links, that's the same
+ * directory, and for extent sharing, the same original.
+ */
+static int
+rep_same(struct replacement *rp1, struct replacement *rp2)
+{
+	if (action == REPLACE_DEDUPE)
+		return(rp1->orig.dir == rp2->orig.dir && rp1->orig.name == rp2->orig.name);
+	return(rp1->dup.dir == rp2->dup.dir);
+}
+
+/*
+ * Order the queue by directory (or by original, for extent sharing),
+ * then by when things were queued.
+ */
+static int
+rep_cmp(const void *p1, const void *p2)
+{
+	const struct replacement *rp1 = (const struct replacement *)p1;
+	const struct replacement *rp2 = (const struct replacement *)p2;
+
+	if (action == REPLACE_DEDUPE) {
+		if (rp1->orig.dir != rp2->orig.dir)
+			return((uintptr_t)rp1->orig.dir < (uintptr_t)rp2->orig.dir ? -1 : 1);
+		if (rp1->orig.name != rp2->orig.name)
+			return((uintptr_t)rp1->orig.name < (uintptr_t)rp2->orig.name ? -1 : 1);
+	} else if (rp1->dup.dir != rp2->dup.dir)
+		return((uintptr_t)rp1->dup.dir < (uintptr_t)rp2->dup.dir ? -1 : 1);
+	return(rp1->seq < rp2->seq ? -1 : rp1->seq > rp2->seq);
+}
+
+/*
+ * Monotonic time, in seconds.
+ */
+static double
+replace_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Do something about the duplicates. They're queued up during the scan,
+ * and dealt with at the end, in one of two ways.
+ *
+ * Replace them with hard links to their originals (-L). This is done
+ * a directory at a time: the directory is opened once, and each file in
+ * it is swapped for a link by making the link under a temporary name
+ * and renaming that over the duplicate. The rename is atomic, so at no
+ * point is the duplicate's name missing.
+ *
+ * Or have the filesystem share their extents with the original (-D),
+ * on filesystems which can (btrfs, XFS). This is done an original at a
+ * time, with FIDEDUPERANGE ioctls covering large ranges of several of
+ * its duplicates at once. The kernel compares the data itself before
+ * it shares anything, and the files stay separate files.
+ *
+ * Either way, the batches are shared out among a few threads.
+ */
+#ifndef _REPLACE_H_
+#define _REPLACE_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "paths.h"
+
+#define REPLACE_MAX_THREADS	64
+
+#define REPLACE_LINK		0
+#define REPLACE_DEDUPE		1
+
+/*
+ * For -D, how much of a file each ioctl covers, and how many of the
+ * duplicates of one original it takes on at once.
+ */
+#define DEDUPE_CHUNK		(16 * 1024 * 1024)
+#define DEDUPE_DESTS		16
+
+/*
+ * A file as it was when it was scanned. A duplicate is only touched if
+ * it still has the inode, size, mtime and ctime it had then (the times
+ * to the nanosecond), and its original the same inode, size and mtime
+ * (its ctime changes as links are made to it). ST_MTIME() and
+ * ST_CTIME() get the times from a struct stat.
+ */
+struct	replace_file	{
+	uint64_t	inode;
+	uint64_t	size;
+	int64_t		mtime;
+	int64_t		ctime;
+};
+
+#ifdef __APPLE__
+#  define ST_MTIME(sp)	((sp)->st_mtimespec.tv_sec * 1000000000LL + (sp)->st_mtimespec.tv_nsec)
+#  define ST_CTIME(sp)	((sp)->st_ctimespec.tv_sec * 1000000000LL + (sp)->st_ctimespec.tv_nsec)
+#else
+#  define ST_MTIME(sp)	((sp)->st_mtim.tv_sec * 1000000000LL + (sp)->st_mtim.tv_nsec)
+#  define ST_CTIME(sp)	((sp)->st_ctim.tv_sec * 1000000000LL + (sp)->st_ctim.tv_nsec)
+#endif
+
+/*
+ * What got done. A file only frees up space if its name was the last
+ * link to its data, so "reclaimed" can be less than "bytes". For -D,
+ * "reclaimed" is what the kernel says it actually shared, and
+ * "differ" counts files it found weren't the same after all.
+ */
+struct	replace_stats	{
+	long		files;
+	long		failed;
+	long		differ;
+	uint64_t	bytes;
+	uint64_t	reclaimed;
+	double		elapsed;
+};
+
+void	replace_add(struct pathref *, struct replace_file *, struct pathref *,
+			struct replace_file *, uint32_t);
+void	replace_run(int, int, int, int, struct replace_stats *);
+
+#endif /* _REPLACE_H_ */
@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Streaming SHA-256, as per FIPS 180-4. This replaces the old trick of
+ * running sha256sum(1) through popen() for every file, which cost us a
+ * fork/exec/pipe per hashed file. The digest is bit-identical to what
+ * sha256sum produces.
+ *
+ * The compression function comes in several flavours - SHA-NI and
+ * AVX2/BMI2 on x86, the crypto extensions on ARMv8, and plain C for
+ * everything else. The best one the CPU supports is picked at startup.
+ */
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#  include <arm_neon.h>
+#  if defined(__linux__) || defined(__FreeBSD__)
+#    include <sys/auxv.h>
+#  endif
+#  if defined(__linux__)
+#    include <asm/hwcap.h>
+#  endif
+#endif
+
+#include "sha256.h"
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BSIG0(x)	(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define BSIG1(x)	(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define SSIG0(x)	(ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x)	(ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+static const uint32_t k256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t h256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * Run the compression function over a number of whole 64-byte blocks.
+ * This is the portable version. It's always inlined into a wrapper so
+ * the compiler can have a second go at it with BMI2 (rorx) enabled.
+ */
+static inline __attribute__((always_inline)) void
+sha256_blocks_c(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+	int i;
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+
+	while (nblocks-- > 0) {
+		for (i = 0; i < 16; i++, data += 4)
+			w[i] = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+				((uint32_t)data[2] << 8) | (uint32_t)data[3];
+		for (; i < 64; i++)
+			w[i] = SSIG1(w[i - 2]) + w[i - 7] + SSIG0(w[i - 15]) + w[i - 16];
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+		for (i = 0; i < 64; i++) {
+			t1 = h + BSIG1(e) + CH(e, f, g) + k256[i] + w[i];
+			t2 = BSIG0(a) + MAJ(a, b, c);
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+static void
+sha256_blocks_scalar(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+	sha256_blocks_c(state, data, nblocks);
+}
+
+static int
+sha256_probe_scalar()
+{
+	return(1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * The portable code again, built for AVX2/BMI2 machines. On these the
+ * rotates become rorx, which doesn't touch the flags and so schedules
+ * much better.
+ */
+__attribute__((target("avx2,bmi2")))
+static void
+sha256_blocks_avx2(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+	sha256_blocks_c(state, data, nblocks);
+}
+
+static int
+sha256_probe_avx2()
+{
+	__builtin_cpu_init();
+	return(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"));
+}
+
+/*
+ * Intel SHA extensions. The state is kept in the ABEF/CDGH layout that
+ * sha256rnds2 wants, and each trip around the inner loop does four
+ * rounds, computing the next four message words with msg1/msg2.
+ */
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_blocks_shani(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+	int i;
+	__m128i st0, st1, tmp, msg, abef, cdgh, m[4];
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+	while (nblocks-- > 0) {
+		abef = st0;
+		cdgh = st1;
+#pragma GCC unroll 16
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+			else
+				m[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]),
+						_mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4)), m[(i + 3) & 3]);
+			msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&k256[i * 4]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, _mm_shuffle_epi32(msg, 0x0e));
+		}
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+		data += SHA256_BLOCK_SIZE;
+	}
+	tmp = _mm_shuffle_epi32(st0, 0x1b);
+	st1 = _mm_shuffle_epi32(st1, 0xb1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, st1, 0xf0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(st1, tmp, 8));
+}
+
+static int
+sha256_probe_shani()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.1") || __get_cpuid_max(0, NULL) < 7)
+		return(0);
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return((ebx >> 29) & 1);
+}
+#endif
+
+#if defined(__aarch64__)
+/*
+ * ARMv8 cryptography extensions. sha256h/sha256h2 do four rounds at a
+ * time on the natural ABCD/EFGH state, and su0/su1 extend the message.
+ */
+__attribute__((target("arch=armv8-a+crypto")))
+static void
+sha256_blocks_armv8(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+	int i;
+	uint32x4_t st0, st1, abcd, efgh, msg, tmp, m[4];
+
+	st0 = vld1q_u32(&state[0]);
+	st1 = vld1q_u32(&state[4]);
+	while (nblocks-- > 0) {
+		abcd = st0;
+		efgh = st1;
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+			else
+				m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]),
+						m[(i + 2) & 3], m[(i + 3) & 3]);
+			msg = vaddq_u32(m[i & 3], vld1q_u32(&k256[i * 4]));
+			tmp = st0;
+			st0 = vsha256hq_u32(st0, st1, msg);
+			st1 = vsha256h2q_u32(st1, tmp, msg);
+		}
+		st0 = vaddq_u32(st0, abcd);
+		st1 = vaddq_u32(st1, efgh);
+		data += SHA256_BLOCK_SIZE;
+	}
+	vst1q_u32(&state[0], st0);
+	vst1q_u32(&state[4], st1);
+}
+
+static int
+sha256_probe_armv8()
+{
+#if defined(__linux__)
+	return((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0);
+#elif defined(__FreeBSD__)
+	unsigned long hwcap = 0;
+
+	elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap));
+	return((hwcap & HWCAP_SHA2) != 0);
+#else
+	return(0);
+#endif
+}
+#endif
+
+/*
+ * The kernels we know about, fastest first. The first one the CPU
+ * supports is used, unless something else is asked for.
+ */
+struct sha256_kernel	sha256_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"shani",	"Intel SHA extensions",		6,	sha256_blocks_shani,	sha256_probe_shani},
+	{"avx2",	"AVX2/BMI2 scalar (rorx)",	1,	sha256_blocks_avx2,	sha256_probe_avx2},
+#endif
+#if defined(__aarch64__)
+	{"armv8",	"ARMv8 crypto extensions",	6,	sha256_blocks_armv8,	sha256_probe_armv8},
+#endif
+	{"scalar",	"portable C",			1,	sha256_blocks_scalar,	sha256_probe_scalar},
+	{NULL,		NULL,				0,	NULL,			NULL}
+};
+
+static struct sha256_kernel	*sha256_kernel = NULL;
+
+/*
+ * Pick a kernel by name, or the best available one if the name is
+ * NULL. Returns -1 if the kernel doesn't exist or the CPU can't run it.
+ */
+int
+sha256_select(const char *name)
+{
+	struct sha256_kernel *kp;
+
+	for (kp = sha256_kernels; kp->name != NULL; kp++) {
+		if (name != NULL && strcmp(name, kp->name) != 0)
+			continue;
+		if (!kp->probe())
+			break;
+		sha256_kernel = kp;
+		return(0);
+	}
+	return(-1);
+}
+
+/*
+ * Return the kernel in use, selecting one if that hasn't happened yet.
+ */
+struct sha256_kernel *
+sha256_current()
+{
+	if (sha256_kernel == NULL)
+		sha256_select(NULL);
+	return(sha256_kernel);
+}
+
+#define sha256_blocks(st, d, n)	(sha256_kernel->blocks((st), (d), (n)))
+
+/*
+ * Multi-buffer kernels. These hash several independent messages at
+ * once, one per vector lane, which is how we get SIMD to help with a
+ * pile of same-sized files. GCC's vector extensions do the heavy
+ * lifting, so the same template serves SSE2/NEON, AVX2 and AVX-512.
+ */
+typedef uint32_t	v4u32 __attribute__((vector_size(16)));
+typedef uint32_t	v8u32 __attribute__((vector_size(32)));
+typedef uint32_t	v16u32 __attribute__((vector_size(64)));
+
+static inline uint32_t
+load_be32(const unsigned char *cp)
+{
+	return(((uint32_t)cp[0] << 24) | ((uint32_t)cp[1] << 16) |
+		((uint32_t)cp[2] << 8) | (uint32_t)cp[3]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define MB_FUNC	sha256_mb_x4
+#  define MB_VEC	v4u32
+#  define MB_LANES	4
+#  define MB_TARGET	"sse2"
+#  include "sha256_mb.h"
+#  define MB_FUNC	sha256_mb_x8
+#  define MB_VEC	v8u32
+#  define MB_LANES	8
+#  define MB_TARGET	"avx2"
+#  include "sha256_mb.h"
+#  define MB_FUNC	sha256_mb_x16
+#  define MB_VEC	v16u32
+#  define MB_LANES	16
+#  define MB_TARGET	"avx512f"
+#  include "sha256_mb.h"
+
+static int
+sha256_probe_avx512()
+{
+	__builtin_cpu_init();
+	return(__builtin_cpu_supports("avx512f"));
+}
+#elif defined(__aarch64__)
+#  define MB_FUNC	sha256_mb_x4
+#  define MB_VEC	v4u32
+#  define MB_LANES	4
+#  define MB_TARGET	"arch=armv8-a"
+#  include "sha256_mb.h"
+#endif
+
+/*
+ * Fastest first, as with the single-stream kernels. There's nothing
+ * here for a machine without 4-lane vectors; sha256_update_multi()
+ * just loops over the messages on those.
+ */
+struct sha256_mb_kernel	sha256_mb_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"x16",		"AVX-512 16-way multi-buffer",	16,	8,	sha256_mb_x16,	sha256_probe_avx512},
+	{"x8",		"AVX2 8-way multi-buffer",	8,	4,	sha256_mb_x8,	sha256_probe_avx2},
+	{"x4",		"SSE2 4-way multi-buffer",	4,	2,	sha256_mb_x4,	sha256_probe_scalar},
+#elif defined(__aarch64__)
+	{"x4",		"NEON 4-way multi-buffer",	4,	2,	sha256_mb_x4,	sha256_probe_scalar},
+#endif
+	{NULL,		NULL,				0,	0,	NULL,		NULL}
+};
+
+static struct sha256_mb_kernel	*sha256_mb_kernel = NULL;
+static int			sha256_mb_selected = 0;
+static int			sha256_mb_forced = 0;
+
+/*
+ * As sha256_select(), but for the multi-buffer kernels. A NULL name
+ * picks the widest one available.
+ */
+int
+sha256_mb_select(const char *name)
+{
+	struct sha256_mb_kernel *kp;
+
+	for (kp = sha256_mb_kernels; kp->name != NULL; kp++) {
+		if (name != NULL && strcmp(name, kp->name) != 0)
+			continue;
+		if (!kp->probe())
+			break;
+		sha256_mb_kernel = kp;
+		sha256_mb_selected = 1;
+		sha256_mb_forced = (name != NULL);
+		return(0);
+	}
+	return(-1);
+}
+
+/*
+ * Return the multi-buffer kernel in use, or NULL if there isn't one.
+ */
+struct sha256_mb_kernel *
+sha256_mb_current()
+{
+	if (!sha256_mb_selected)
+		sha256_mb_select(NULL);
+	sha256_mb_selected = 1;
+	return(sha256_mb_kernel);
+}
+
+/*
+ * Compress the same number of whole blocks for each of "n" messages.
+ * They're fed to the multi-buffer kernel a vector's worth at a time.
+ * A short final group is padded out with copies of its first lane
+ * (into a scratch context).
+ *
+ * A multi-buffer pass isn't always a win. SHA-NI on one message is
+ * quicker than AVX2 on eight, and a mostly-empty pass is wasted work.
+ * So unless a kernel was asked for by name, a group goes through the
+ * vector kernel only if doing its messages one at a time would cost
+ * more, going by the rough speed of each kernel relative to scalar C.
+ */
+static void
+sha256_blocks_multi(struct sha256_ctx **ctx, int n, const unsigned char **data, size_t nblocks)
+{
+	int i, lanes;
+	struct sha256_ctx scratch, *cv[16];
+	const unsigned char *dv[16];
+	struct sha256_mb_kernel *kp = sha256_mb_current();
+
+	for (; n > 0; n -= lanes, ctx += lanes, data += lanes) {
+		lanes = (kp == NULL || kp->lanes > n) ? n : kp->lanes;
+		if (kp == NULL || n == 1 || (!sha256_mb_forced &&
+				lanes * kp->speed <= kp->lanes * sha256_kernel->speed)) {
+			sha256_blocks(ctx[0]->state, data[0], nblocks);
+			lanes = 1;
+			continue;
+		}
+		if ((lanes = kp->lanes) <= n) {
+			kp->blocks(ctx, data, nblocks);
+			continue;
+		}
+		scratch = *ctx[0];
+		for (i = 0; i < kp->lanes; i++) {
+			cv[i] = i < n ? ctx[i] : &scratch;
+			dv[i] = i < n ? data[i] : data[0];
+		}
+		kp->blocks(cv, dv, nblocks);
+	}
+}
+
+/*
+ * Start a new digest.
+ */
+void
+sha256_init(struct sha256_ctx *ctx)
+{
+	if (sha256_kernel == NULL)
+		sha256_select(NULL);
+	memcpy(ctx->state, h256, sizeof(h256));
+	ctx->count = 0;
+	ctx->buflen = 0;
+}
+
+/*
+ * Feed some more data into the digest. Whole blocks are compressed
+ * straight from the caller's buffer - we only copy the odd bits at
+ * either end.
+ */
+void
+sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	size_t n;
+	const unsigned char *cp = data;
+
+	ctx->count += len;
+	if (ctx->buflen > 0) {
+		n = SHA256_BLOCK_SIZE - ctx->buflen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->buf + ctx->buflen, cp, n);
+		ctx->buflen += n;
+		cp += n;
+		len -= n;
+		if (ctx->buflen < SHA256_BLOCK_SIZE)
+			return;
+		sha256_blocks(ctx->state, ctx->buf, 1);
+		ctx->buflen = 0;
+	}
+	if ((n = len / SHA256_BLOCK_SIZE) > 0) {
+		sha256_blocks(ctx->state, cp, n);
+		cp += n * SHA256_BLOCK_SIZE;
+		len -= n * SHA256_BLOCK_SIZE;
+	}
+	if (len > 0) {
+		memcpy(ctx->buf, cp, len);
+		ctx->buflen = len;
+	}
+}
+
+/*
+ * Pad out the final block, append the bit count and hand back the
+ * big-endian digest.
+ */
+void
+sha256_final(struct sha256_ctx *ctx, unsigned char *digest)
+{
+	int i;
+	uint64_t bits = ctx->count << 3;
+
+	ctx->buf[ctx->buflen++] = 0x80;
+	if (ctx->buflen > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->buf + ctx->buflen, 0, SHA256_BLOCK_SIZE - ctx->buflen);
+		sha256_blocks(ctx->state, ctx->buf, 1);
+		ctx->buflen = 0;
+	}
+	memset(ctx->buf + ctx->buflen, 0, SHA256_BLOCK_SIZE - 8 - ctx->buflen);
+	for (i = 0; i < 8; i++)
+		ctx->buf[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (i * 8));
+	sha256_blocks(ctx->state, ctx->buf, 1);
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+	}
+}
+
+/*
+ * Feed "len" bytes into each of "n" digests at once, message i coming
+ * from data[i]. This is the multi-buffer equivalent of sha256_update().
+ * The digests are expected to be in lock-step (same amount hashed so
+ * far), as they will be for files of the same size. If they're not,
+ * we just update them one at a time.
+ */
+void
+sha256_update_multi(struct sha256_ctx **ctx, int n, const unsigned char **data, size_t len)
+{
+	int i;
+	size_t m, off, buflen, nblocks;
+	const unsigned char *dv[SHA256_MAX_MULTI];
+
+	if (n > SHA256_MAX_MULTI) {
+		for (i = 0; i < n; i++)
+			sha256_update(ctx[i], data[i], len);
+		return;
+	}
+	buflen = ctx[0]->buflen;
+	for (i = 1; i < n; i++) {
+		if (ctx[i]->buflen != buflen) {
+			for (i = 0; i < n; i++)
+				sha256_update(ctx[i], data[i], len);
+			return;
+		}
+	}
+	off = 0;
+	for (i = 0; i < n; i++)
+		ctx[i]->count += len;
+	if (buflen > 0) {
+		if ((m = SHA256_BLOCK_SIZE - buflen) > len)
+			m = len;
+		for (i = 0; i < n; i++) {
+			memcpy(ctx[i]->buf + buflen, data[i], m);
+			ctx[i]->buflen += m;
+			dv[i] = ctx[i]->buf;
+		}
+		if (buflen + m < SHA256_BLOCK_SIZE)
+			return;
+		sha256_blocks_multi(ctx, n, dv, 1);
+		for (i = 0; i < n; i++)
+			ctx[i]->buflen = 0;
+		off = m;
+	}
+	if ((nblocks = (len - off) / SHA256_BLOCK_SIZE) > 0) {
+		for (i = 0; i < n; i++)
+			dv[i] = data[i] + off;
+		sha256_blocks_multi(ctx, n, dv, nblocks);
+		off += nblocks * SHA256_BLOCK_SIZE;
+	}
+	if (off < len) {
+		for (i = 0; i < n; i++) {
+			memcpy(ctx[i]->buf, data[i] + off, len - off);
+			ctx[i]->buflen = len - off;
+		}
+	}
+}
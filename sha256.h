@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Streaming SHA-256 (FIPS 180-4). Same digest as sha256sum(1).
+ */
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_DIGEST_SIZE	32
+#define SHA256_MAX_MULTI	64
+
+struct	sha256_ctx	{
+	uint32_t	state[8];
+	uint64_t	count;
+	size_t		buflen;
+	unsigned char	buf[SHA256_BLOCK_SIZE];
+};
+
+/*
+ * A compression function implementation, and a probe to see if this
+ * CPU can run it. The speed is a rough guide to throughput relative to
+ * the portable C code.
+ */
+struct	sha256_kernel	{
+	char	*name;
+	char	*desc;
+	int	speed;
+	void	(*blocks)(uint32_t *, const unsigned char *, size_t);
+	int	(*probe)();
+};
+
+/*
+ * A multi-buffer kernel, which compresses one block from each of
+ * "lanes" separate messages in a single pass.
+ */
+struct	sha256_mb_kernel	{
+	char	*name;
+	char	*desc;
+	int	lanes;
+	int	speed;
+	void	(*blocks)(struct sha256_ctx **, const unsigned char **, size_t);
+	int	(*probe)();
+};
+
+extern struct sha256_kernel	sha256_kernels[];
+extern struct sha256_mb_kernel	sha256_mb_kernels[];
+
+int			sha256_select(const char *);
+struct sha256_kernel	*sha256_current();
+int			sha256_mb_select(const char *);
+struct sha256_mb_kernel	*sha256_mb_current();
+void	sha256_init(struct sha256_ctx *);
+void	sha256_update(struct sha256_ctx *, const void *, size_t);
+void	sha256_final(struct sha256_ctx *, unsigned char *);
+void	sha256_update_multi(struct sha256_ctx **, int, const unsigned char **, size_t);
+
+#endif /* _SHA256_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Multi-buffer SHA-256 compression. This isn't a real header - it's a
+ * template which sha256.c includes once for each lane count, with the
+ * following defined:
+ *
+ *	MB_FUNC		name of the function to generate
+ *	MB_VEC		vector type with one 32-bit element per lane
+ *	MB_LANES	number of lanes (elements in MB_VEC)
+ *	MB_TARGET	target attribute string for the compiler
+ *
+ * Each lane runs an independent message through the same sequence of
+ * rounds, so the whole thing is just the scalar algorithm written in
+ * vector arithmetic. Every lane must have the same number of blocks.
+ */
+__attribute__((target(MB_TARGET)))
+static void
+MB_FUNC(struct sha256_ctx **ctx, const unsigned char **data, size_t nblocks)
+{
+	int i, j;
+	size_t off;
+	MB_VEC w[16], s[8], a, b, c, d, e, f, g, h, t1, t2;
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < MB_LANES; j++)
+			s[i][j] = ctx[j]->state[i];
+	for (off = 0; nblocks-- > 0; off += SHA256_BLOCK_SIZE) {
+		for (i = 0; i < 16; i++)
+			for (j = 0; j < MB_LANES; j++)
+				w[i][j] = load_be32(data[j] + off + i * 4);
+		a = s[0]; b = s[1]; c = s[2]; d = s[3];
+		e = s[4]; f = s[5]; g = s[6]; h = s[7];
+		for (i = 0; i < 64; i++) {
+			if (i >= 16)
+				w[i & 15] += SSIG1(w[(i - 2) & 15]) + w[(i - 7) & 15] + SSIG0(w[(i - 15) & 15]);
+			t1 = h + BSIG1(e) + CH(e, f, g) + k256[i] + w[i & 15];
+			t2 = BSIG0(a) + MAJ(a, b, c);
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+		s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+	}
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < MB_LANES; j++)
+			ctx[j]->state[i] = s[i][j];
+}
+
+#undef MB_FUNC
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_TARGET
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Robin Hood hash table keyed on file size. On insertion, a key which
+ * has travelled further from its home slot than the occupant evicts
+ * it, and the occupant carries on looking. That keeps every probe
+ * sequence about the same (short) length, and means a lookup can stop
+ * as soon as it meets a slot closer to home than it is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sizeidx.h"
+
+#define SIDX_MIN_SLOTS	1024
+
+static struct sidx_slot	*sidx_alloc(size_t);
+static void		sidx_grow(struct size_index *);
+
+/*
+ * Fibonacci hashing - multiply by 2^64/phi and take the top bits. File
+ * sizes are often multiples of a block size, so the low bits on their
+ * own would be useless.
+ */
+#define sidx_home(ip, sz)	((size_t)(((sz) * 0x9e3779b97f4a7c15ULL) >> (ip)->shift))
+
+/*
+ * How far slot "i" is from where its occupant would like to be.
+ */
+#define sidx_dist(ip, i)	(((i) - sidx_home(ip, (ip)->slots[i].size)) & (ip)->mask)
+
+/*
+ * Set up an empty index, with room for roughly "hint" sizes before it
+ * has to grow.
+ */
+void
+sidx_init(struct size_index *ip, size_t hint)
+{
+	size_t nslots;
+
+	for (nslots = SIDX_MIN_SLOTS, ip->shift = 64 - 10; nslots < hint + hint / 4; nslots *= 2)
+		ip->shift--;
+	ip->slots = sidx_alloc(nslots);
+	ip->mask = nslots - 1;
+	ip->count = 0;
+}
+
+/*
+ * Release the table. Whatever the values point to is the caller's
+ * problem.
+ */
+void
+sidx_free(struct size_index *ip)
+{
+	free((void *)ip->slots);
+	ip->slots = NULL;
+	ip->mask = ip->count = 0;
+}
+
+/*
+ * Find the value for a given size. Returns a pointer to the value in
+ * the table, or NULL if there's no such size. The pointer is only good
+ * until the next insertion.
+ */
+void **
+sidx_lookup(struct size_index *ip, uint64_t size)
+{
+	size_t i, dist;
+
+	for (i = sidx_home(ip, size), dist = 0;; i = (i + 1) & ip->mask, dist++) {
+		if (ip->slots[i].size == size)
+			return(&ip->slots[i].value);
+		if (ip->slots[i].size == SIDX_EMPTY || sidx_dist(ip, i) < dist)
+			return(NULL);
+	}
+}
+
+/*
+ * Find the value for a given size, adding the size (with a NULL value)
+ * if it isn't there already. As with sidx_lookup(), the pointer is
+ * only good until the next insertion.
+ */
+void **
+sidx_insert(struct size_index *ip, uint64_t size)
+{
+	size_t i, dist, odist;
+	void **vp;
+	struct sidx_slot cur, tmp;
+
+	if ((vp = sidx_lookup(ip, size)) != NULL)
+		return(vp);
+	if ((ip->count + 1) * 8 > (ip->mask + 1) * 7)
+		sidx_grow(ip);
+	cur.size = size;
+	cur.value = NULL;
+	for (vp = NULL, i = sidx_home(ip, size), dist = 0;; i = (i + 1) & ip->mask, dist++) {
+		if (ip->slots[i].size == SIDX_EMPTY) {
+			ip->slots[i] = cur;
+			if (vp == NULL)
+				vp = &ip->slots[i].value;
+			break;
+		}
+		if ((odist = sidx_dist(ip, i)) < dist) {
+			/*
+			 * The occupant is closer to home than we are,
+			 * so it has to move. The first swap is where
+			 * the new size ends up.
+			 */
+			tmp = ip->slots[i];
+			ip->slots[i] = cur;
+			cur = tmp;
+			dist = odist;
+			if (vp == NULL)
+				vp = &ip->slots[i].value;
+		}
+	}
+	ip->count++;
+	return(vp);
+}
+
+/*
+ * Double the size of the table, and re-insert everything.
+ */
+static void
+sidx_grow(struct size_index *ip)
+{
+	size_t i, nslots;
+	void **vp;
+	struct sidx_slot *old;
+
+	old = ip->slots;
+	nslots = ip->mask + 1;
+	ip->slots = sidx_alloc(nslots * 2);
+	ip->mask = nslots * 2 - 1;
+	ip->shift--;
+	ip->count = 0;
+	for (i = 0; i < nslots; i++) {
+		if (old[i].size == SIDX_EMPTY)
+			continue;
+		vp = sidx_insert(ip, old[i].size);
+		*vp = old[i].value;
+	}
+	free((void *)old);
+}
+
+/*
+ * Allocate a table of empty slots.
+ */
+static struct sidx_slot *
+sidx_alloc(size_t nslots)
+{
+	size_t i;
+	struct sidx_slot *sp;
+
+	if ((sp = (struct sidx_slot *)malloc(nslots * sizeof(struct sidx_slot))) == NULL) {
+		perror("sidx_alloc malloc");
+		exit(1);
+	}
+	for (i = 0; i < nslots; i++) {
+		sp[i].size = SIDX_EMPTY;
+		sp[i].value = NULL;
+	}
+	return(sp);
+}
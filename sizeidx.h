@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * An open-addressing hash table keyed on file size. Each occupied slot
+ * holds a size and an opaque pointer to whatever the caller keeps for
+ * that size. Collisions are resolved with Robin Hood probing, so probe
+ * sequences stay short even when the table is nearly full, and the
+ * table doubles when it gets too crowded.
+ */
+#ifndef _SIZEIDX_H_
+#define _SIZEIDX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A slot. Sixteen bytes, so four to a cache line. Empty slots have a
+ * size of SIDX_EMPTY, which no file can be.
+ */
+#define SIDX_EMPTY	(~(uint64_t)0)
+
+struct	sidx_slot	{
+	uint64_t	size;
+	void		*value;
+};
+
+struct	size_index	{
+	struct sidx_slot	*slots;
+	size_t			mask;
+	size_t			count;
+	int			shift;
+};
+
+void	sidx_init(struct size_index *, size_t);
+void	sidx_free(struct size_index *);
+void	**sidx_lookup(struct size_index *, uint64_t);
+void	**sidx_insert(struct size_index *, uint64_t);
+
+#endif /* _SIZEIDX_H_ */
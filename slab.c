@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Fixed-size objects in big chunks, addressed by index.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+/*
+ * Set up an empty slab of objects of "size" bytes. That's normally a
+ * sizeof(), which is already a multiple of the object's alignment, and
+ * the chunks are cache line aligned, so every object is aligned too.
+ */
+void
+slab_init(struct slab *sp, size_t size)
+{
+	sp->chunks = NULL;
+	sp->size = size < sizeof(uint32_t) ? sizeof(uint32_t) : size;
+	sp->n = 0;
+	sp->nchunks = 0;
+	sp->free = SLAB_NONE;
+}
+
+/*
+ * Allocate an object, and return its index. The contents are whatever
+ * was there before.
+ */
+uint32_t
+slab_alloc(struct slab *sp)
+{
+	uint32_t i;
+
+	if ((i = sp->free) != SLAB_NONE) {
+		memcpy(&sp->free, slab_ptr(sp, i), sizeof(uint32_t));
+		return(i);
+	}
+	if (sp->n == SLAB_NONE) {
+		fprintf(stderr, "slab_alloc: too many objects.\n");
+		exit(1);
+	}
+	if ((sp->n >> SLAB_SHIFT) == sp->nchunks) {
+		sp->chunks = (char **)realloc(sp->chunks, (sp->nchunks + 1) * sizeof(char *));
+		if (sp->chunks == NULL ||
+		    posix_memalign((void **)&sp->chunks[sp->nchunks], 64, sp->size << SLAB_SHIFT) != 0) {
+			perror("slab_alloc");
+			exit(1);
+		}
+		sp->nchunks++;
+	}
+	return(sp->n++);
+}
+
+/*
+ * Give an object back. The first four bytes of it hold the link.
+ */
+void
+slab_free(struct slab *sp, uint32_t i)
+{
+	memcpy(slab_ptr(sp, i), &sp->free, sizeof(uint32_t));
+	sp->free = i;
+}
+
+/*
+ * How much memory the chunks take up.
+ */
+size_t
+slab_memory(struct slab *sp)
+{
+	return(((size_t)sp->nchunks * sp->size) << SLAB_SHIFT);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A slab allocator for small fixed-size objects. Objects are carved
+ * out of large chunks, one after the other, and are known by a 32-bit
+ * index rather than a pointer. Chunks never move once allocated, so a
+ * pointer to an object stays good for as long as the object does.
+ * Freed objects go on a list (threaded through the objects themselves)
+ * and are reused first.
+ */
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Objects per chunk, as a power of two. Index "i" lives in chunk
+ * i >> SLAB_SHIFT, at slot i & SLAB_MASK.
+ */
+#define SLAB_SHIFT	14
+#define SLAB_MASK	((1 << SLAB_SHIFT) - 1)
+#define SLAB_NONE	(~(uint32_t)0)
+
+struct	slab	{
+	char		**chunks;
+	size_t		size;
+	uint32_t	n;
+	uint32_t	nchunks;
+	uint32_t	free;
+};
+
+void		slab_init(struct slab *, size_t);
+uint32_t	slab_alloc(struct slab *);
+void		slab_free(struct slab *, uint32_t);
+size_t		slab_memory(struct slab *);
+
+/*
+ * The object with index "i".
+ */
+static inline void *
+slab_ptr(struct slab *sp, uint32_t i)
+{
+	return(sp->chunks[i >> SLAB_SHIFT] + (size_t)(i & SLAB_MASK) * sp->size);
+}
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Directory snapshots, and the per-directory listing stack.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+
+/*
+ * The old snapshot (if there is one), mapped.
+ */
+static struct snap_header	*old = NULL;
+static size_t			old_size;
+static struct snap_dir		*old_dirs;
+static uint32_t			*old_slots;
+static struct snap_ent		*old_ents;
+static char			*old_names;
+
+/*
+ * The new one, as it's built. If we're not keeping it, only the
+ * entries and names of the directories being processed are here.
+ */
+static char			*snap_path = NULL;
+static int64_t			snap_start;
+static struct snap_dir		*dirs = NULL;
+static size_t			ndirs, max_dirs;
+static struct snap_ent		*ents = NULL;
+static size_t			nents, max_ents;
+static char			*names = NULL;
+static size_t			nnames, max_names;
+
+static int64_t	snap_mtime(struct stat *);
+static void	*snap_grow(void *, size_t *, size_t, size_t);
+static void	snap_write(FILE *, void *, size_t);
+
+#define snap_home(dev, ino, n) \
+	((size_t)((((ino) ^ ((uint64_t)(dev) << 48)) * 0x9e3779b97f4a7c15ULL) >> 32) & ((n) - 1))
+
+/*
+ * Keep a snapshot in "path", and map the last one, if there is one. A
+ * snapshot which doesn't look right is ignored.
+ */
+void
+snap_open(const char *path)
+{
+	int fd;
+	struct stat st;
+	struct timespec ts;
+	struct snap_header *hp;
+
+	if ((snap_path = strdup(path)) == NULL) {
+		perror("snap_open strdup");
+		exit(1);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	snap_start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return;
+		perror(path);
+		exit(1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (st.st_size < (off_t)sizeof(struct snap_header)) {
+		close(fd);
+		return;
+	}
+	old_size = st.st_size;
+	if ((hp = (struct snap_header *)mmap(NULL, old_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("snap_open mmap");
+		exit(1);
+	}
+	close(fd);
+	if (memcmp(hp->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0 || hp->version != SNAP_VERSION ||
+	    hp->nslots == 0 || (hp->nslots & (hp->nslots - 1)) != 0 ||
+	    old_size != sizeof(*hp) + hp->ndirs * sizeof(struct snap_dir) + hp->nslots * sizeof(uint32_t) +
+			hp->nents * sizeof(struct snap_ent) + hp->nnames) {
+		fprintf(stderr, "dupscan: ignoring snapshot %s (wrong format).\n", path);
+		munmap((void *)hp, old_size);
+		return;
+	}
+	old = hp;
+	old_dirs = (struct snap_dir *)(hp + 1);
+	old_slots = (uint32_t *)(old_dirs + hp->ndirs);
+	old_ents = (struct snap_ent *)(old_slots + hp->nslots);
+	old_names = (char *)(old_ents + hp->nents);
+}
+
+/*
+ * Where the next directory's listing will start.
+ */
+size_t
+snap_mark()
+{
+	return(nents);
+}
+
+/*
+ * Add an entry to the current listing, as read from the directory.
+ */
+void
+snap_entry(const char *name, int type)
+{
+	size_t len;
+	struct snap_ent *ep;
+
+	len = strlen(name) + 1;
+	ents = (struct snap_ent *)snap_grow(ents, &max_ents, nents + 1, sizeof(struct snap_ent));
+	names = (char *)snap_grow(names, &max_names, nnames + len, 1);
+	ep = &ents[nents++];
+	memset(ep, 0, sizeof(*ep));
+	ep->name = nnames;
+	ep->type = type;
+	memcpy(names + nnames, name, len);
+	nnames += len;
+}
+
+/*
+ * If the old snapshot has this directory (by its stat), and it hasn't
+ * changed since, copy its listing to the current one and return 1.
+ */
+int
+snap_replay(struct stat *sp)
+{
+	size_t i, j, len;
+	struct snap_dir *dp;
+	struct snap_ent *ep;
+
+	if (old == NULL)
+		return(0);
+	for (i = snap_home(sp->st_dev, sp->st_ino, old->nslots);; i = (i + 1) & (old->nslots - 1)) {
+		if (old_slots[i] == 0)
+			return(0);
+		dp = &old_dirs[old_slots[i] - 1];
+		if (dp->inode == (uint64_t)sp->st_ino && dp->device == (uint64_t)sp->st_dev)
+			break;
+	}
+	if (dp->mtime == 0 || dp->mtime != snap_mtime(sp))
+		return(0);
+	ents = (struct snap_ent *)snap_grow(ents, &max_ents, nents + dp->n, sizeof(struct snap_ent));
+	for (j = 0; j < dp->n; j++) {
+		ep = &old_ents[dp->first + j];
+		len = strlen(old_names + ep->name) + 1;
+		names = (char *)snap_grow(names, &max_names, nnames + len, 1);
+		ents[nents] = *ep;
+		ents[nents++].name = nnames;
+		memcpy(names + nnames, old_names + ep->name, len);
+		nnames += len;
+	}
+	return(1);
+}
+
+/*
+ * A directory (by its stat) is done with, and its listing is entries
+ * "first" to "last"-1. If we're keeping a snapshot, add it, otherwise
+ * drop the listing. An mtime which is too close to when we started
+ * might not catch a change made in the same tick, so it's not kept.
+ */
+void
+snap_dir(struct stat *sp, size_t first, size_t last)
+{
+	struct snap_dir *dp;
+
+	if (snap_path == NULL) {
+		if (first < nents)
+			nnames = ents[first].name;
+		nents = first;
+		return;
+	}
+	dirs = (struct snap_dir *)snap_grow(dirs, &max_dirs, ndirs + 1, sizeof(struct snap_dir));
+	dp = &dirs[ndirs++];
+	dp->device = sp->st_dev;
+	dp->inode = sp->st_ino;
+	dp->mtime = snap_mtime(sp);
+	if (dp->mtime >= snap_start - 1000000000LL)
+		dp->mtime = 0;
+	dp->first = first;
+	dp->n = last - first;
+}
+
+/*
+ * Entry "i" of the listings, and its name. These move as the listings
+ * grow, so they're only good until the next snap_entry() or
+ * snap_replay().
+ */
+struct snap_ent *
+snap_get(size_t i)
+{
+	return(&ents[i]);
+}
+
+const char *
+snap_name(size_t i)
+{
+	return(names + ents[i].name);
+}
+
+/*
+ * Write the new snapshot (if we're keeping one) to a temporary file,
+ * and rename it over the old one.
+ */
+void
+snap_close()
+{
+	size_t i, j, nslots;
+	uint32_t *slots;
+	char *tmp;
+	FILE *fp;
+	struct snap_header hdr;
+
+	if (snap_path != NULL) {
+		for (nslots = 1024; nslots < ndirs * 2; nslots *= 2)
+			;
+		if ((slots = (uint32_t *)calloc(nslots, sizeof(uint32_t))) == NULL ||
+		    (tmp = (char *)malloc(strlen(snap_path) + 32)) == NULL) {
+			perror("snap_close malloc");
+			exit(1);
+		}
+		for (i = 0; i < ndirs; i++) {
+			for (j = snap_home(dirs[i].device, dirs[i].inode, nslots); slots[j] != 0; j = (j + 1) & (nslots - 1))
+				;
+			slots[j] = i + 1;
+		}
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+		hdr.version = SNAP_VERSION;
+		hdr.ndirs = ndirs;
+		hdr.nslots = nslots;
+		hdr.nents = nents;
+		hdr.nnames = nnames;
+		sprintf(tmp, "%s.%d", snap_path, (int)getpid());
+		if ((fp = fopen(tmp, "w")) == NULL) {
+			perror(tmp);
+			exit(1);
+		}
+		snap_write(fp, &hdr, sizeof(hdr));
+		snap_write(fp, dirs, ndirs * sizeof(struct snap_dir));
+		snap_write(fp, slots, nslots * sizeof(uint32_t));
+		snap_write(fp, ents, nents * sizeof(struct snap_ent));
+		snap_write(fp, names, nnames);
+		if (fclose(fp) != 0 || rename(tmp, snap_path) < 0) {
+			perror(tmp);
+			exit(1);
+		}
+		free((void *)slots);
+		free((void *)tmp);
+	}
+	if (old != NULL)
+		munmap((void *)old, old_size);
+	old = NULL;
+}
+
+/*
+ * A file's mtime, in nanoseconds.
+ */
+static int64_t
+snap_mtime(struct stat *sp)
+{
+#ifdef __APPLE__
+	return(sp->st_mtimespec.tv_sec * 1000000000LL + sp->st_mtimespec.tv_nsec);
+#else
+	return(sp->st_mtim.tv_sec * 1000000000LL + sp->st_mtim.tv_nsec);
+#endif
+}
+
+/*
+ * Make sure an array has room for "n" elements of "size" bytes.
+ */
+static void *
+snap_grow(void *p, size_t *maxp, size_t n, size_t size)
+{
+	if (n <= *maxp)
+		return(p);
+	while (*maxp < n)
+		*maxp = *maxp == 0 ? 4096 : *maxp * 2;
+	if ((p = realloc(p, *maxp * size)) == NULL) {
+		perror("snap_grow realloc");
+		exit(1);
+	}
+	return(p);
+}
+
+/*
+ * fwrite(), or die trying.
+ */
+static void
+snap_write(FILE *fp, void *p, size_t n)
+{
+	if (n > 0 && fwrite(p, 1, n, fp) != n) {
+		perror("snap_write");
+		exit(1);
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Directory snapshots for incremental rescans (-S). The snapshot file
+ * has every directory in the tree, keyed on device and inode, with its
+ * mtime and a listing of its entries: name, type, and for regular
+ * files, the size, inode number, link count, mtime and ctime. On the
+ * next run, a directory whose mtime hasn't changed gets its listing
+ * from the snapshot, so it's neither read nor are its files stat()ed.
+ * The old snapshot is mapped, and looked up in place. A new one is
+ * built as the scan goes, and replaces it at the end.
+ *
+ * The same listing arrays are used (as a stack) to hold each directory
+ * while it's being processed, snapshot or not.
+ *
+ * What's reused is the listings and stat data, not any results. The
+ * digests come from the hash cache (-C), which -S always has - next to
+ * the snapshot, if not given one - so files in unchanged directories
+ * aren't hashed again either. A file rewritten in place doesn't change
+ * its directory's mtime, though, so its size and times in the snapshot
+ * can be out of date. The hash cache stat()s a file from the snapshot
+ * before it trusts a digest for it, and -L and -D won't touch a file
+ * whose times aren't still the ones it was scanned with.
+ */
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SNAP_MAGIC	"dupsnap"
+#define SNAP_VERSION	2
+
+/*
+ * An entry. The name is an offset into the names. SNAP_STAT says the
+ * size, inode, link count and times are filled in.
+ */
+#define SNAP_STAT	0x01
+
+struct	snap_ent	{
+	uint64_t	size;
+	uint64_t	inode;
+	int64_t		mtime;
+	int64_t		ctime;
+	uint32_t	nlink;
+	uint32_t	name;
+	uint16_t	type;
+	uint16_t	flags;
+	uint32_t	pad;
+};
+
+/*
+ * A directory, and where its entries are. An mtime of zero means the
+ * listing isn't to be trusted (it was too recent when it was taken).
+ */
+struct	snap_dir	{
+	uint64_t	device;
+	uint64_t	inode;
+	int64_t		mtime;
+	uint64_t	first;
+	uint64_t	n;
+};
+
+/*
+ * The file is the header, then the directories, a hash table of
+ * directory numbers (plus one, so zero is empty), the entries and the
+ * names.
+ */
+struct	snap_header	{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	pad;
+	uint64_t	ndirs;
+	uint64_t	nslots;
+	uint64_t	nents;
+	uint64_t	nnames;
+};
+
+void		snap_open(const char *);
+size_t		snap_mark();
+void		snap_entry(const char *, int);
+int		snap_replay(struct stat *);
+void		snap_dir(struct stat *, size_t, size_t);
+struct snap_ent	*snap_get(size_t);
+const char	*snap_name(size_t);
+void		snap_close();
+
+#endif /* _SNAPSHOT_H_ */
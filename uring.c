@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * A minimal io_uring wrapper. Set up the rings, register some fixed
+ * buffers, queue READ_FIXED requests, and submit them all with a
+ * single io_uring_enter() which also waits for completions. The kernel
+ * and we share the ring indices, so the head/tail updates need the
+ * acquire/release ordering that liburing would otherwise take care of.
+ */
+#include "uring.h"
+
+#ifdef HAVE_URING
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * Create a ring with room for "entries" submissions. Returns -1 (with
+ * errno set) if the kernel doesn't do io_uring, or won't let us.
+ */
+int
+uring_init(struct uring *up, unsigned entries)
+{
+	int err;
+	struct io_uring_params p;
+
+	memset(up, 0, sizeof(*up));
+	memset(&p, 0, sizeof(p));
+	if ((up->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return(-1);
+	up->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	up->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (up->cq_ring_size > up->sq_ring_size)
+			up->sq_ring_size = up->cq_ring_size;
+		up->cq_ring_size = up->sq_ring_size;
+	}
+	up->sq_ring = mmap(NULL, up->sq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, up->fd, IORING_OFF_SQ_RING);
+	if (up->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		up->cq_ring = up->sq_ring;
+	else {
+		up->cq_ring = mmap(NULL, up->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, up->fd, IORING_OFF_CQ_RING);
+		if (up->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+	up->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	up->sqes = (struct io_uring_sqe *)mmap(NULL, up->sqes_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, up->fd, IORING_OFF_SQES);
+	if (up->sqes == MAP_FAILED)
+		goto fail;
+	up->sq_head = (unsigned *)((char *)up->sq_ring + p.sq_off.head);
+	up->sq_tail = (unsigned *)((char *)up->sq_ring + p.sq_off.tail);
+	up->sq_mask = (unsigned *)((char *)up->sq_ring + p.sq_off.ring_mask);
+	up->sq_array = (unsigned *)((char *)up->sq_ring + p.sq_off.array);
+	up->cq_head = (unsigned *)((char *)up->cq_ring + p.cq_off.head);
+	up->cq_tail = (unsigned *)((char *)up->cq_ring + p.cq_off.tail);
+	up->cq_mask = (unsigned *)((char *)up->cq_ring + p.cq_off.ring_mask);
+	up->cqes = (struct io_uring_cqe *)((char *)up->cq_ring + p.cq_off.cqes);
+	return(0);
+fail:
+	err = errno;
+	uring_exit(up);
+	errno = err;
+	return(-1);
+}
+
+/*
+ * Tear down a ring.
+ */
+void
+uring_exit(struct uring *up)
+{
+	if (up->sqes != NULL && up->sqes != MAP_FAILED)
+		munmap(up->sqes, up->sqes_size);
+	if (up->cq_ring != NULL && up->cq_ring != MAP_FAILED && up->cq_ring != up->sq_ring)
+		munmap(up->cq_ring, up->cq_ring_size);
+	if (up->sq_ring != NULL && up->sq_ring != MAP_FAILED)
+		munmap(up->sq_ring, up->sq_ring_size);
+	if (up->fd >= 0)
+		close(up->fd);
+	up->fd = -1;
+	up->sqes = NULL;
+	up->sq_ring = up->cq_ring = NULL;
+}
+
+/*
+ * Register buffers with the kernel, so it can skip pinning and mapping
+ * them on every read.
+ */
+int
+uring_register_buffers(struct uring *up, struct iovec *iov, int n)
+{
+	return(syscall(__NR_io_uring_register, up->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0);
+}
+
+/*
+ * Queue a read into registered buffer "bufidx". It isn't submitted
+ * until the next uring_submit_wait(). The caller mustn't queue more
+ * than the ring has room for.
+ */
+void
+uring_read_fixed(struct uring *up, int fd, void *buf, unsigned len, off_t off, int bufidx, unsigned long data)
+{
+	unsigned tail, idx;
+	struct io_uring_sqe *sqe;
+
+	tail = *up->sq_tail;
+	idx = tail & *up->sq_mask;
+	sqe = &up->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->buf_index = bufidx;
+	sqe->user_data = data;
+	up->sq_array[idx] = idx;
+	__atomic_store_n(up->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	up->pending++;
+}
+
+/*
+ * Submit everything queued, and wait for at least "wait_nr" of the
+ * reads to complete.
+ */
+int
+uring_submit_wait(struct uring *up, unsigned wait_nr)
+{
+	int n;
+
+	do {
+		n = syscall(__NR_io_uring_enter, up->fd, up->pending, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return(-1);
+	up->pending -= n;
+	return(n);
+}
+
+/*
+ * The next completion, or NULL if there isn't one.
+ */
+struct io_uring_cqe *
+uring_peek(struct uring *up)
+{
+	unsigned head;
+
+	head = *up->cq_head;
+	if (head == __atomic_load_n(up->cq_tail, __ATOMIC_ACQUIRE))
+		return(NULL);
+	return(&up->cqes[head & *up->cq_mask]);
+}
+
+/*
+ * We're done with the completion uring_peek() returned.
+ */
+void
+uring_seen(struct uring *up)
+{
+	__atomic_store_n(up->cq_head, *up->cq_head + 1, __ATOMIC_RELEASE);
+}
+#endif /* HAVE_URING */
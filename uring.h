@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Just enough io_uring (Linux 5.1+) to read files asynchronously,
+ * using the raw system calls so there's no dependency on liburing.
+ */
+#ifndef _URING_H_
+#define _URING_H_
+
+#ifdef __linux__
+#  include <linux/io_uring.h>
+#  define HAVE_URING	1
+#endif
+
+#ifdef HAVE_URING
+#include <sys/uio.h>
+
+struct	uring	{
+	int			fd;
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_array;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_size;
+	size_t			cq_ring_size;
+	size_t			sqes_size;
+	unsigned		pending;
+};
+
+int			uring_init(struct uring *, unsigned);
+void			uring_exit(struct uring *);
+int			uring_register_buffers(struct uring *, struct iovec *, int);
+void			uring_read_fixed(struct uring *, int, void *, unsigned, off_t, int, unsigned long);
+int			uring_submit_wait(struct uring *, unsigned);
+struct io_uring_cqe	*uring_peek(struct uring *);
+void			uring_seen(struct uring *);
+#endif
+
+#endif /* _URING_H_ */
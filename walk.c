@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Walk a directory tree with a pool of threads. Each thread has a deque
+ * of directories it has found but not yet read. It pushes and pops at
+ * the back (so it goes depth-first, and stays near what it just read),
+ * and idle threads steal from the front, which is where the biggest
+ * unexplored subtrees tend to be. Each deque has its own lock, so there
+ * is no lock that every thread has to take. A single atomic counter of
+ * outstanding directories tells everyone when the walk is over.
+ *
+ * Directories are read with getdents64() into a large buffer, rather
+ * than an entry at a time. The entry type the kernel hands back means
+ * directories and symlinks never need a stat() at all. Regular files
+ * (and anything the filesystem won't give a type for) get an fstatat()
+ * relative to the open directory, so the kernel doesn't have to walk
+ * the whole path again for every file.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+#include "walk.h"
+#include "ratelimit.h"
+
+struct	deque	{
+	pthread_mutex_t	lock;
+	struct dirnode	**dirs;
+	size_t		head;
+	size_t		tail;
+	size_t		max;
+};
+
+struct	worker	{
+	int		id;
+	pthread_t	thread;
+	struct deque	dq;
+	long		dirs;
+	long		entries;
+	long		stats;
+} __attribute__((aligned(64)));
+
+static struct worker	*workers;
+static int		nworkers;
+static int		wverbose;
+static walk_func	wfunc;
+static long		pending;
+
+static void	*walk_worker(void *);
+static void	walk_dir(struct worker *, struct dirnode *);
+static void	dq_push(struct deque *, struct dirnode *);
+static struct dirnode	*dq_pop(struct deque *);
+static struct dirnode	*dq_steal(struct deque *);
+
+/*
+ * Walk the tree under "root" with "nthreads" threads, calling "func" for
+ * every regular file. Symlinks are ignored, and anything else (devices,
+ * sockets) is fatal, the same as the single-threaded scan. Directory
+ * nodes are added to the path arenas as we go.
+ */
+void
+walk_tree(char *root, int nthreads, int verbose, walk_func func, struct walk_stats *wsp)
+{
+	int i;
+	struct timespec t0, t1;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > WALK_MAX_THREADS)
+		nthreads = WALK_MAX_THREADS;
+	if ((workers = (struct worker *)aligned_alloc(64, nthreads * sizeof(struct worker))) == NULL) {
+		perror("walk_tree malloc");
+		exit(1);
+	}
+	memset(workers, 0, nthreads * sizeof(struct worker));
+	nworkers = nthreads;
+	wverbose = verbose;
+	wfunc = func;
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].dq.lock, NULL);
+	}
+	pending = 1;
+	dq_push(&workers[0].dq, path_dir(0, NULL, root));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 1; i < nthreads; i++)
+		if (pthread_create(&workers[i].thread, NULL, walk_worker, &workers[i]) != 0) {
+			perror("walk_tree pthread_create");
+			exit(1);
+		}
+	walk_worker(&workers[0]);
+	for (i = 1; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	wsp->dirs = wsp->entries = wsp->stats = 0;
+	for (i = 0; i < nthreads; i++) {
+		wsp->dirs += workers[i].dirs;
+		wsp->entries += workers[i].entries;
+		wsp->stats += workers[i].stats;
+		pthread_mutex_destroy(&workers[i].dq.lock);
+		free((void *)workers[i].dq.dirs);
+	}
+	wsp->elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	free((void *)workers);
+	workers = NULL;
+}
+
+/*
+ * The main loop for each thread. Work through our own deque, then look
+ * for something to steal. Only give up when there are no directories
+ * left anywhere - queued, or being read by another thread (which might
+ * find more).
+ */
+static void *
+walk_worker(void *arg)
+{
+	int i;
+	struct dirnode *dir;
+	struct worker *wp = (struct worker *)arg;
+
+	for (;;) {
+		if ((dir = dq_pop(&wp->dq)) == NULL) {
+			for (i = 1; i < nworkers && dir == NULL; i++)
+				dir = dq_steal(&workers[(wp->id + i) % nworkers].dq);
+		}
+		if (dir == NULL) {
+			if (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) == 0)
+				break;
+			sched_yield();
+			continue;
+		}
+		walk_dir(wp, dir);
+		__atomic_sub_fetch(&pending, 1, __ATOMIC_RELEASE);
+	}
+	return(NULL);
+}
+
+/*
+ * Read one directory. Subdirectories go on our own deque, and regular
+ * files go straight to the caller.
+ */
+static void
+walk_dir(struct worker *wp, struct dirnode *dir)
+{
+	int type;
+	char *name, path[PATH_MAX], buf[PATH_MAX];
+	struct dirscan ds;
+	struct stat stbuf;
+
+	path_build(dir, NULL, path);
+	if (wverbose)
+		printf("Directory: %s\n", path);
+	if (dir_open(&ds, AT_FDCWD, path, dir->parent == NULL) < 0) {
+		perror(path);
+		exit(1);
+	}
+	wp->dirs++;
+	while (dir_next(&ds, &name, &type) > 0) {
+		wp->entries++;
+		if (type == DT_REG || type == DT_UNKNOWN) {
+			wp->stats++;
+			rate_take(RATE_OPS, 1);
+			if (fstatat(ds.fd, name, &stbuf, AT_SYMLINK_NOFOLLOW) < 0) {
+				fprintf(stderr, "%s/%s: ", path, name);
+				perror("walk_dir fstatat");
+				exit(1);
+			}
+			type = IFTODT(stbuf.st_mode);
+		}
+		switch (type) {
+		case DT_REG:
+			wfunc(wp->id, dir, name, &stbuf);
+			break;
+
+		case DT_DIR:
+			__atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+			dq_push(&wp->dq, path_dir(wp->id, dir, name));
+			break;
+
+		case DT_LNK:
+			if (wverbose)
+				printf("Ignoring a symlink (%s).\n", path_build(dir, name, buf));
+			break;
+
+		default:
+			fprintf(stderr, "Can't handle file type for %s.\n", path_build(dir, name, buf));
+			exit(1);
+		}
+	}
+	dir_close(&ds);
+}
+
+/*
+ * Open directory "name" (relative to directory "dfd") for reading.
+ * Returns -1 with errno set on failure. Symlinks aren't followed,
+ * unless "follow" is set - which it is for the directory we were
+ * given to scan, since that's the user's to name any way they like.
+ */
+int
+dir_open(struct dirscan *dsp, int dfd, const char *name, int follow)
+{
+#ifndef __linux__
+	int err;
+#endif
+
+	rate_take(RATE_OPS, 1);
+	if ((dsp->fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW))) < 0)
+		return(-1);
+#ifdef __linux__
+	if ((dsp->buf = (char *)malloc(WALK_DIRBUF)) == NULL) {
+		perror("dir_open malloc");
+		exit(1);
+	}
+	dsp->pos = dsp->len = 0;
+#else
+	if ((dsp->dirp = fdopendir(dsp->fd)) == NULL) {
+		err = errno;
+		close(dsp->fd);
+		errno = err;
+		return(-1);
+	}
+#endif
+	return(0);
+}
+
+/*
+ * The next entry in the directory, skipping "." and "..". The name is
+ * only good until the next call. The type is one of the DT_ values
+ * from dirent.h, and can be DT_UNKNOWN if the filesystem doesn't keep
+ * it. Returns 0 at the end of the directory.
+ */
+int
+dir_next(struct dirscan *dsp, char **namep, int *typep)
+{
+#ifdef __linux__
+	long n;
+	struct dirent64 {
+		uint64_t	d_ino;
+		int64_t		d_off;
+		unsigned short	d_reclen;
+		unsigned char	d_type;
+		char		d_name[];
+	} *dp;
+
+	for (;;) {
+		if (dsp->pos >= dsp->len) {
+			rate_take(RATE_OPS, 1);
+			if ((n = syscall(SYS_getdents64, dsp->fd, dsp->buf, WALK_DIRBUF)) < 0) {
+				perror("getdents64");
+				exit(1);
+			}
+			if (n == 0)
+				return(0);
+			dsp->len = n;
+			dsp->pos = 0;
+		}
+		dp = (struct dirent64 *)(dsp->buf + dsp->pos);
+		dsp->pos += dp->d_reclen;
+		if (*dp->d_name == '.' && (dp->d_name[1] == '\0' || (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+			continue;
+		*namep = dp->d_name;
+		*typep = dp->d_type;
+		return(1);
+	}
+#else
+	struct dirent *dp;
+
+	while ((dp = readdir(dsp->dirp)) != NULL) {
+		if (*dp->d_name == '.' && (dp->d_name[1] == '\0' || (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+			continue;
+		*namep = dp->d_name;
+		*typep = dp->d_type;
+		return(1);
+	}
+	return(0);
+#endif
+}
+
+/*
+ * Finished with a directory.
+ */
+void
+dir_close(struct dirscan *dsp)
+{
+#ifdef __linux__
+	close(dsp->fd);
+	free((void *)dsp->buf);
+	dsp->buf = NULL;
+#else
+	closedir(dsp->dirp);
+#endif
+	dsp->fd = -1;
+}
+
+/*
+ * Add a directory to the back of a deque. Only the owner does this.
+ */
+static void
+dq_push(struct deque *dqp, struct dirnode *dir)
+{
+	pthread_mutex_lock(&dqp->lock);
+	if (dqp->tail == dqp->max) {
+		if (dqp->head > 0) {
+			/*
+			 * Slide everything down to the start, and
+			 * only grow if it's still more than half full.
+			 */
+			memmove(dqp->dirs, dqp->dirs + dqp->head, (dqp->tail - dqp->head) * sizeof(struct dirnode *));
+			dqp->tail -= dqp->head;
+			dqp->head = 0;
+		}
+		if (dqp->tail * 2 > dqp->max || dqp->max == 0) {
+			dqp->max = dqp->max == 0 ? 256 : dqp->max * 2;
+			if ((dqp->dirs = (struct dirnode **)realloc(dqp->dirs, dqp->max * sizeof(struct dirnode *))) == NULL) {
+				perror("dq_push realloc");
+				exit(1);
+			}
+		}
+	}
+	dqp->dirs[dqp->tail++] = dir;
+	pthread_mutex_unlock(&dqp->lock);
+}
+
+/*
+ * Take the most recently added directory from the back of our own
+ * deque.
+ */
+static struct dirnode *
+dq_pop(struct deque *dqp)
+{
+	struct dirnode *dir = NULL;
+
+	pthread_mutex_lock(&dqp->lock);
+	if (dqp->tail > dqp->head)
+		dir = dqp->dirs[--dqp->tail];
+	if (dqp->tail == dqp->head)
+		dqp->tail = dqp->head = 0;
+	pthread_mutex_unlock(&dqp->lock);
+	return(dir);
+}
+
+/*
+ * Steal the oldest directory from the front of someone else's deque.
+ * Don't wait around if the owner (or another thief) has it locked.
+ */
+static struct dirnode *
+dq_steal(struct deque *dqp)
+{
+	struct dirnode *dir = NULL;
+
+	if (pthread_mutex_trylock(&dqp->lock) != 0)
+		return(NULL);
+	if (dqp->tail > dqp->head)
+		dir = dqp->dirs[dqp->head++];
+	if (dqp->tail == dqp->head)
+		dqp->tail = dqp->head = 0;
+	pthread_mutex_unlock(&dqp->lock);
+	return(dir);
+}
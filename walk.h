@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Parallel directory traversal. A pool of threads, each with its own
+ * deque of directories still to be read. A thread works from the back
+ * of its own deque, and when that runs dry it steals from the front of
+ * somebody else's.
+ *
+ * Also the directory reader that both this and the single-threaded
+ * scan use. It reads entries in bulk (getdents64 on Linux) from a
+ * directory opened relative to its parent.
+ */
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "paths.h"
+
+#define WALK_MAX_THREADS	64
+#define WALK_DIRBUF		(64 * 1024)
+
+/*
+ * What to do with each regular file. It's called on the thread which
+ * found the file (0 to nthreads-1), with the directory's node and the
+ * file's name. The name is only good for the duration of the call.
+ */
+typedef void	(*walk_func)(int, struct dirnode *, const char *, struct stat *);
+
+struct	walk_stats	{
+	long		dirs;		/* directories read */
+	long		entries;	/* directory entries seen */
+	long		stats;		/* fstatat() calls */
+	double		elapsed;	/* wall-clock seconds */
+};
+
+/*
+ * An open directory being read.
+ */
+struct	dirscan	{
+	int		fd;
+#ifdef __linux__
+	char		*buf;
+	size_t		pos;
+	size_t		len;
+#else
+	DIR		*dirp;
+#endif
+};
+
+void	walk_tree(char *, int, int, walk_func, struct walk_stats *);
+int	dir_open(struct dirscan *, int, const char *, int);
+int	dir_next(struct dirscan *, char **, int *);
+void	dir_close(struct dirscan *);
+
+#endif /* _WALK_H_ */
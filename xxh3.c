@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * XXH3-128, after Yann Collet's xxHash (BSD licensed). Only the parts we
+ * need are here: no seed, the default secret, and a streaming interface
+ * so a file can be hashed a buffer at a time. It's not cryptographic,
+ * but it's very quick, and for an internal dedup pass that's all we want.
+ *
+ * Inputs of up to 240 bytes are hashed in one go from the buffer at the
+ * end. Anything longer is consumed 64-byte "stripe" at a time into eight
+ * accumulators, which are scrambled after every 16 stripes. The last
+ * stripe is always held back, as it gets special treatment at the end.
+ * The digest is the canonical big-endian form, high half first.
+ */
+#include <string.h>
+
+#include "xxh3.h"
+
+#define PRIME32_1	0x9e3779b1U
+#define PRIME32_2	0x85ebca77U
+#define PRIME32_3	0xc2b2ae3dU
+#define PRIME64_1	0x9e3779b185ebca87ULL
+#define PRIME64_2	0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3	0x165667b19e3779f9ULL
+#define PRIME64_4	0x85ebca77c2b2ae63ULL
+#define PRIME64_5	0x27d4eb2f165667c5ULL
+#define PRIME_MX1	0x165667919e3779f9ULL
+#define PRIME_MX2	0x9fb21c651e98df25ULL
+
+#define STRIPE_LEN	64
+#define SECRET_SIZE	192
+#define SECRET_LIMIT	(SECRET_SIZE - STRIPE_LEN)
+#define STRIPES_PER_BLOCK	((SECRET_SIZE - STRIPE_LEN) / 8)
+#define MIDSIZE_MAX	240
+#define LASTACC_START	7
+#define MERGEACCS_START	11
+
+static const unsigned char secret[SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+struct	u128	{
+	uint64_t	lo;
+	uint64_t	hi;
+};
+
+static inline uint32_t
+rd32(const unsigned char *cp)
+{
+	return((uint32_t)cp[0] | ((uint32_t)cp[1] << 8) | ((uint32_t)cp[2] << 16) | ((uint32_t)cp[3] << 24));
+}
+
+static inline uint64_t
+rd64(const unsigned char *cp)
+{
+	return((uint64_t)rd32(cp) | ((uint64_t)rd32(cp + 4) << 32));
+}
+
+static inline uint32_t
+bswap32(uint32_t x)
+{
+	return(__builtin_bswap32(x));
+}
+
+static inline uint64_t
+rotl64(uint64_t x, int n)
+{
+	return((x << n) | (x >> (64 - n)));
+}
+
+static inline struct u128
+mul128(uint64_t a, uint64_t b)
+{
+	struct u128 r;
+	unsigned __int128 p = (unsigned __int128)a * b;
+
+	r.lo = (uint64_t)p;
+	r.hi = (uint64_t)(p >> 64);
+	return(r);
+}
+
+static inline uint64_t
+mul128_fold64(uint64_t a, uint64_t b)
+{
+	struct u128 r = mul128(a, b);
+
+	return(r.lo ^ r.hi);
+}
+
+static inline uint64_t
+xxh64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	return(h ^ (h >> 32));
+}
+
+static inline uint64_t
+xxh3_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= PRIME_MX1;
+	return(h ^ (h >> 32));
+}
+
+static inline uint64_t
+mix16(const unsigned char *in, const unsigned char *sec)
+{
+	return(mul128_fold64(rd64(in) ^ rd64(sec), rd64(in + 8) ^ rd64(sec + 8)));
+}
+
+static inline struct u128
+mix32(struct u128 acc, const unsigned char *in1, const unsigned char *in2, const unsigned char *sec)
+{
+	acc.lo += mix16(in1, sec);
+	acc.lo ^= rd64(in2) + rd64(in2 + 8);
+	acc.hi += mix16(in2, sec + 16);
+	acc.hi ^= rd64(in1) + rd64(in1 + 8);
+	return(acc);
+}
+
+/*
+ * Finish off a 17..240 byte hash from the two accumulated halves.
+ */
+static struct u128
+mid_final(struct u128 acc, size_t len)
+{
+	struct u128 h;
+
+	h.lo = xxh3_avalanche(acc.lo + acc.hi);
+	h.hi = 0 - xxh3_avalanche(acc.lo * PRIME64_1 + acc.hi * PRIME64_4 + len * PRIME64_2);
+	return(h);
+}
+
+/*
+ * The one-shot hash for short inputs (up to MIDSIZE_MAX bytes). There
+ * is a different recipe for each range of lengths.
+ */
+static struct u128
+xxh3_short(const unsigned char *in, size_t len)
+{
+	int i;
+	uint32_t c, ch;
+	uint64_t lo, hi, x;
+	struct u128 h, m, acc;
+
+	if (len == 0) {
+		h.lo = xxh64_avalanche(rd64(secret + 64) ^ rd64(secret + 72));
+		h.hi = xxh64_avalanche(rd64(secret + 80) ^ rd64(secret + 88));
+		return(h);
+	}
+	if (len <= 3) {
+		c = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) |
+			(uint32_t)in[len - 1] | ((uint32_t)len << 8);
+		ch = bswap32(c);
+		ch = (ch << 13) | (ch >> 19);
+		h.lo = xxh64_avalanche((uint64_t)c ^ (rd32(secret) ^ rd32(secret + 4)));
+		h.hi = xxh64_avalanche((uint64_t)ch ^ (rd32(secret + 8) ^ rd32(secret + 12)));
+		return(h);
+	}
+	if (len <= 8) {
+		x = (uint64_t)rd32(in) + ((uint64_t)rd32(in + len - 4) << 32);
+		x ^= rd64(secret + 16) ^ rd64(secret + 24);
+		m = mul128(x, PRIME64_1 + (len << 2));
+		m.hi += m.lo << 1;
+		m.lo ^= m.hi >> 3;
+		m.lo ^= m.lo >> 35;
+		m.lo *= PRIME_MX2;
+		m.lo ^= m.lo >> 28;
+		m.hi = xxh3_avalanche(m.hi);
+		return(m);
+	}
+	if (len <= 16) {
+		lo = rd64(in);
+		hi = rd64(in + len - 8);
+		m = mul128(lo ^ hi ^ (rd64(secret + 32) ^ rd64(secret + 40)), PRIME64_1);
+		m.lo += (uint64_t)(len - 1) << 54;
+		hi ^= rd64(secret + 48) ^ rd64(secret + 56);
+		m.hi += hi + (uint64_t)(uint32_t)hi * (PRIME32_2 - 1);
+		m.lo ^= __builtin_bswap64(m.hi);
+		h = mul128(m.lo, PRIME64_2);
+		h.hi += m.hi * PRIME64_2;
+		h.lo = xxh3_avalanche(h.lo);
+		h.hi = xxh3_avalanche(h.hi);
+		return(h);
+	}
+	acc.lo = len * PRIME64_1;
+	acc.hi = 0;
+	if (len <= 128) {
+		if (len > 32) {
+			if (len > 64) {
+				if (len > 96)
+					acc = mix32(acc, in + 48, in + len - 64, secret + 96);
+				acc = mix32(acc, in + 32, in + len - 48, secret + 64);
+			}
+			acc = mix32(acc, in + 16, in + len - 32, secret + 32);
+		}
+		acc = mix32(acc, in, in + len - 16, secret);
+		return(mid_final(acc, len));
+	}
+	for (i = 32; i < 160; i += 32)
+		acc = mix32(acc, in + i - 32, in + i - 16, secret + i - 32);
+	acc.lo = xxh3_avalanche(acc.lo);
+	acc.hi = xxh3_avalanche(acc.hi);
+	for (i = 160; i <= len; i += 32)
+		acc = mix32(acc, in + i - 32, in + i - 16, secret + 3 + i - 160);
+	acc = mix32(acc, in + len - 16, in + len - 32, secret + 136 - 17 - 16);
+	return(mid_final(acc, len));
+}
+
+/*
+ * Accumulate one 64-byte stripe.
+ */
+static inline void
+accumulate_512(uint64_t *acc, const unsigned char *in, const unsigned char *sec)
+{
+	int i;
+	uint64_t v, k;
+
+	for (i = 0; i < 8; i++) {
+		v = rd64(in + i * 8);
+		k = v ^ rd64(sec + i * 8);
+		acc[i ^ 1] += v;
+		acc[i] += (k & 0xffffffff) * (k >> 32);
+	}
+}
+
+static inline void
+scramble(uint64_t *acc)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= rd64(secret + SECRET_LIMIT + i * 8);
+		acc[i] *= PRIME32_1;
+	}
+}
+
+/*
+ * Consume some whole stripes, scrambling at the end of every block.
+ * The position within the block carries over from call to call.
+ */
+static void
+consume_stripes(uint64_t *acc, size_t *nstripes, const unsigned char *in, size_t n)
+{
+	while (n > 0) {
+		accumulate_512(acc, in, secret + *nstripes * 8);
+		in += STRIPE_LEN;
+		n--;
+		if (++*nstripes == STRIPES_PER_BLOCK) {
+			scramble(acc);
+			*nstripes = 0;
+		}
+	}
+}
+
+static uint64_t
+merge_accs(const uint64_t *acc, const unsigned char *sec, uint64_t start)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		start += mul128_fold64(acc[i * 2] ^ rd64(sec + i * 16), acc[i * 2 + 1] ^ rd64(sec + i * 16 + 8));
+	return(xxh3_avalanche(start));
+}
+
+/*
+ * Start a new hash.
+ */
+void
+xxh3_init(struct xxh3_ctx *ctx)
+{
+	ctx->acc[0] = PRIME32_3;
+	ctx->acc[1] = PRIME64_1;
+	ctx->acc[2] = PRIME64_2;
+	ctx->acc[3] = PRIME64_3;
+	ctx->acc[4] = PRIME64_4;
+	ctx->acc[5] = PRIME32_2;
+	ctx->acc[6] = PRIME64_5;
+	ctx->acc[7] = PRIME32_1;
+	ctx->count = 0;
+	ctx->nstripes = 0;
+	ctx->buflen = 0;
+}
+
+/*
+ * Feed more data in. Whatever doesn't make up a whole stripe - and the
+ * last whole stripe, which has to be kept for the finish - stays in
+ * the buffer. The buffer's final stripe is always the most recent one
+ * consumed, in case the finish needs to look back at it.
+ */
+void
+xxh3_update(struct xxh3_ctx *ctx, const void *data, size_t len)
+{
+	size_t n;
+	const unsigned char *cp = data, *end = cp + len;
+
+	ctx->count += len;
+	if (len <= XXH3_BUFFER_SIZE - ctx->buflen) {
+		memcpy(ctx->buf + ctx->buflen, cp, len);
+		ctx->buflen += len;
+		return;
+	}
+	if (ctx->buflen > 0) {
+		n = XXH3_BUFFER_SIZE - ctx->buflen;
+		memcpy(ctx->buf + ctx->buflen, cp, n);
+		cp += n;
+		consume_stripes(ctx->acc, &ctx->nstripes, ctx->buf, XXH3_BUFFER_SIZE / STRIPE_LEN);
+		ctx->buflen = 0;
+	}
+	if (end - cp > XXH3_BUFFER_SIZE) {
+		n = (end - 1 - cp) / STRIPE_LEN;
+		consume_stripes(ctx->acc, &ctx->nstripes, cp, n);
+		cp += n * STRIPE_LEN;
+		memcpy(ctx->buf + XXH3_BUFFER_SIZE - STRIPE_LEN, cp - STRIPE_LEN, STRIPE_LEN);
+	}
+	memcpy(ctx->buf, cp, end - cp);
+	ctx->buflen = end - cp;
+}
+
+/*
+ * Produce the 16-byte digest.
+ */
+void
+xxh3_final(struct xxh3_ctx *ctx, unsigned char *digest)
+{
+	int i;
+	size_t n, ns;
+	uint64_t acc[8];
+	unsigned char last[STRIPE_LEN];
+	const unsigned char *lp;
+	struct u128 h;
+
+	if (ctx->count <= MIDSIZE_MAX)
+		h = xxh3_short(ctx->buf, ctx->count);
+	else {
+		memcpy(acc, ctx->acc, sizeof(acc));
+		if (ctx->buflen >= STRIPE_LEN) {
+			n = (ctx->buflen - 1) / STRIPE_LEN;
+			ns = ctx->nstripes;
+			consume_stripes(acc, &ns, ctx->buf, n);
+			lp = ctx->buf + ctx->buflen - STRIPE_LEN;
+		} else {
+			n = STRIPE_LEN - ctx->buflen;
+			memcpy(last, ctx->buf + XXH3_BUFFER_SIZE - n, n);
+			memcpy(last + n, ctx->buf, ctx->buflen);
+			lp = last;
+		}
+		accumulate_512(acc, lp, secret + SECRET_LIMIT - LASTACC_START);
+		h.lo = merge_accs(acc, secret + MERGEACCS_START, ctx->count * PRIME64_1);
+		h.hi = merge_accs(acc, secret + SECRET_SIZE - 64 - MERGEACCS_START, ~(ctx->count * PRIME64_2));
+	}
+	for (i = 0; i < 8; i++) {
+		digest[i] = (unsigned char)(h.hi >> (56 - i * 8));
+		digest[i + 8] = (unsigned char)(h.lo >> (56 - i * 8));
+	}
+}
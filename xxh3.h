@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026, Dermot Tynan.  All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2, or (at your option) any later version.
+ *
+ * It is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this product; see the file COPYING.  If not, write to the Free
+ * Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * ABSTRACT
+ * Streaming XXH3-128 (unseeded, default secret). Same result as
+ * "xxhsum -H2".
+ */
+#ifndef _XXH3_H_
+#define _XXH3_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define XXH3_DIGEST_SIZE	16
+#define XXH3_BUFFER_SIZE	256
+
+struct	xxh3_ctx	{
+	uint64_t	acc[8];
+	uint64_t	count;
+	size_t		nstripes;
+	size_t		buflen;
+	unsigned char	buf[XXH3_BUFFER_SIZE];
+};
+
+void	xxh3_init(struct xxh3_ctx *);
+void	xxh3_update(struct xxh3_ctx *, const void *, size_t);
+void	xxh3_final(struct xxh3_ctx *, unsigned char *);
+
+#endif /* _XXH3_H_ */